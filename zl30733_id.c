@@ -2,196 +2,162 @@
 
 /*
  * ZL30733 / ZL3073x identity reader over Linux spidev
- * - Verifies Chip ID against a small known list
- * - Prints a friendly device name when recognized
+ * - Verifies Chip ID against the capability database (zl_chips.c)
+ * - Prints the variant name when recognized
  * - Dumps Revision, FW version, Custom Config version
+ * - Further commands (polling, capture decoding, ...) are dispatched
+ *   from the commands[] table
  *
  * Notes:
  * * Page size = 0x80; page select register = 0x7F (low nibble)
  * * Multi-byte fields are big-endian
- * * Start with MODE0, 1 MHz if unsure and tune up
+ * * Start with MODE0, 1 MHz if unsure and tune up ("tune -w" finds and
+ *   saves the fastest reliable speed, used when -s is not given)
+ * * Without -m the mode is probed once per device node and saved
  */
 
 #define _GNU_SOURCE
 #include <errno.h>
 #include <err.h>
-#include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
-#include <linux/spi/spidev.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
-#ifndef ARRAY_SIZE
-#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
-#endif
-
-/* ZL3073x register map basics */
-#define ZL_PAGE_SIZE  0x80
-#define ZL_PAGE_SEL   0x7F
-
-/* Identity block (page 0) */
-#define ZL_REG_ID                 0x0001  // u16, big-endian: Chip ID / family
-#define ZL_REG_REVISION           0x0003  // u8: single-byte stepping code (default 0x03 per
-                                          //     DS20006552M page-0 map). Reading 2 bytes here
-                                          //     pulls in the next register and prints garbage.
-#define ZL_REG_FW_VER             0x0005  // u16, big-endian
-#define ZL_REG_CUSTOM_CONFIG_VER  0x0007  // u32, big-endian
-
-/* Known Chip IDs (best-effort; exact mapping can vary by OTP/package) */
-static struct id_map {
-    uint16_t id;
-    const char *name;
-} const known_ids[] = {
-    /* Common ZL3073x family IDs */
-    { .id = 0x0E95, .name = "ZL3073x (A)" },
-    { .id = 0x1E95, .name = "ZL3073x (B)" },
-    { .id = 0x2E95, .name = "ZL3073x (C)" },
-};
-
-static const char *devnode = "/dev/spidev0.0";
-static uint32_t speed_hz = 1000000; /* 1 MHz default */
-static uint8_t mode = SPI_MODE_0; /* default MODE0 */
-static uint8_t bits_per_word = 8;
-static int debug = 0;
-
-static void
-hexdump(const char *prefix, const uint8_t *buf, size_t len)
-{
-    fprintf(stderr, "%s", prefix);
-    for (size_t i = 0; i < len; i++)
-        fprintf(stderr, "%s%02X", i ? " " : "", buf[i]);
-    fprintf(stderr, "\n");
-}
-
-static const
-char *lookup_name(uint16_t id)
-{
-    for (size_t i = 0; i < ARRAY_SIZE(known_ids); i++) {
-        if (known_ids[i].id == id)
-            return known_ids[i].name;
-    }
-    return "Unknown";
-}
-
-static int
-spi_write_u8(int fd, uint8_t reg_off, uint8_t val)
-{
-    uint8_t tx[2] = { [0] = reg_off, [1] = val };
-    if (debug > 0) {
-        char pfx[64];
-	snprintf(pfx, sizeof(pfx), "SPI_W: off=0x%02X,  data=", reg_off);
-        hexdump(pfx, &tx[1], 1);
-    }
-    struct spi_ioc_transfer xfer = {
-        .tx_buf = (unsigned long)tx,
-        .rx_buf = 0,
-        .len    = sizeof(tx),
-        .speed_hz = speed_hz,
-        .bits_per_word = bits_per_word,
-        .cs_change = 0
-    };
+#include "zl3073x.h"
 
-    int ret = ioctl(fd, SPI_IOC_MESSAGE(1), &xfer);
-
-    return (ret < 1) ? -1 : 0;
-}
+const char *devnode = "/dev/spidev0.0";
+const char *state_path = "/var/lib/zl30733_id/state";
+uint32_t speed_hz = 1000000; /* 1 MHz default */
+uint8_t mode = SPI_MODE_0; /* default MODE0 */
+uint8_t bits_per_word = 8;
+int debug = 0;
+enum zl_format out_format = ZL_FMT_TEXT;
 
 static int
-spi_read(int fd, uint8_t reg_off, uint8_t *buf, size_t len)
+cmd_id(int fd, int argc, char **argv)
 {
-    int r = 0;
-
-    if (len == 0 || len > 255)
-        return -EINVAL;
-
-    uint8_t *tx = calloc(1, len + 1);
-    uint8_t *rx = calloc(1, len + 1);
-    if (!tx || !rx) {
-        r = -ENOMEM;
-	goto fini;
-    }
-
-    tx[0] = 0x80 | (reg_off & 0x7F);
+    uint16_t chip_id, fw_ver;
+    uint8_t revision;
+    uint32_t cfg_ver;
 
-    struct spi_ioc_transfer xfer = {
-        .tx_buf = (unsigned long)tx,
-        .rx_buf = (unsigned long)rx,
-        .len    = (uint32_t)(len + 1),
-        .speed_hz = speed_hz,
-        .bits_per_word = bits_per_word,
-        .cs_change = 0
-    };
+    (void)argc;
+    (void)argv;
 
-    int ret = ioctl(fd, SPI_IOC_MESSAGE(1), &xfer);
+#define ZL_READ_REG(FD, REG, OUTVAR, LEN) do { \
+    size_t _len = (size_t)(LEN);                                                \
+    uint8_t _b[8];                                                              \
+    if (_len > sizeof(_b))                                                      \
+        errx(EXIT_FAILURE, #REG " read len %zu > %zu", _len, sizeof(_b));       \
+    if (_len > sizeof(OUTVAR))                                                  \
+        warnx(#REG " read len %zu > %zu for " #OUTVAR, _len, sizeof(OUTVAR));   \
+    if (zl_read_reg((FD), (REG), _b, _len) < 0)                                 \
+        errx(EXIT_FAILURE, "read %s failed", #REG);                             \
+    if (_len == 1) {                                                            \
+        (OUTVAR) = (typeof(OUTVAR))_b[0];                                       \
+    } else if (_len == 2) {                                                     \
+        uint16_t _t; memcpy(&_t, _b, 2);                                        \
+        (OUTVAR) = (typeof(OUTVAR))ntohs(_t);                                   \
+    } else if (_len == 4) {                                                     \
+        uint32_t _t; memcpy(&_t, _b, 4);                                        \
+        (OUTVAR) = (typeof(OUTVAR))ntohl(_t);                                   \
+    } else {                                                                    \
+        errx(EXIT_FAILURE, #REG " unsupported LEN=%zu (only 8,16,32 bits)", _len);\
+    }                                                                           \
+} while (0)
 
-    if (ret < 1) {
-        r = -1;
-	goto fini;
-    }
+    ZL_READ_REG(fd, ZL_REG_ID, chip_id, 2);
+    ZL_READ_REG(fd, ZL_REG_REVISION, revision, 1);
+    ZL_READ_REG(fd, ZL_REG_FW_VER, fw_ver, 2);
+    ZL_READ_REG(fd, ZL_REG_CUSTOM_CONFIG_VER, cfg_ver, 4);
 
-    if (debug > 0) {
-      char pfx[64];
-      snprintf(pfx, sizeof(pfx), "SPI_R: off=0x%02X rx=", reg_off);
-      hexdump(pfx, rx + 1, len); /* skip echoed address byte */
+    if (out_format != ZL_FMT_TEXT) {
+        static struct zl_rec rec;
+        const char *name = zl_chip_name(chip_id);
+
+        zl_rec_begin(&rec);
+        zl_rec_str(&rec, "device", devnode);
+        zl_rec_hex(&rec, "chip_id", chip_id, 2);
+        zl_rec_str(&rec, "name", name ? name : "Unknown");
+        zl_rec_hex(&rec, "revision", revision, 1);
+        zl_rec_u64(&rec, "rev_major", (revision >> 4) & 0xF);
+        zl_rec_u64(&rec, "rev_minor", revision & 0xF);
+        zl_rec_hex(&rec, "fw_ver", fw_ver, 2);
+        zl_rec_hex(&rec, "custom_config_ver", cfg_ver, 4);
+        if (zl_rec_end(&rec) < 0)
+            errx(EXIT_FAILURE, "write identity record failed");
+        return EXIT_SUCCESS;
     }
 
-    memcpy(buf, rx + 1, len); /* skip echoed address byte */
-
-fini:
-    free(tx);
-    free(rx);
-    return r;
-}
-
-static int
-zl_set_page(int fd, uint8_t page)
-{
-    if (page > 0x0F)
-        return -EINVAL; /* 4-bit page field */
-
-    if (debug > 0)
-        fprintf(stderr, "PAGE -> 0x%X (write 0x%02X to 0x%02X)\n",
-                        page & 0xf, page & 0xf, ZL_PAGE_SEL);
+    /* done, print it */
+    printf("ZL3073x identity via %s\n", devnode);
+    printf("  Chip ID              : 0x%04X  (%s)\n", chip_id,
+           zl_chip_name(chip_id) ? zl_chip_name(chip_id) : "Unknown");
+    printf("  Revision             : 0x%02X  (major=%u minor=%u)\n",
+           revision, (revision >> 4) & 0xF, revision & 0xF);
+    printf("  Firmware Version     : 0x%04X\n", fw_ver);
+    printf("  Custom Config Version: 0x%08X\n", cfg_ver);
 
-    return spi_write_u8(fd, ZL_PAGE_SEL, page & 0x0F);
+    return EXIT_SUCCESS;
 }
 
-static int
-zl_read_reg(int fd, uint16_t reg, uint8_t *buf, size_t len)
-{
-    uint8_t page = (reg >> 7) & 0x0F;
-    uint8_t off  = reg & 0x7F;
-
-    int rc = zl_set_page(fd, page);
-
-    if (rc)
-        return rc;
-
-    return spi_read(fd, off, buf, len);
-}
+static const struct command {
+    const char *name;
+    int (*run)(int fd, int argc, char **argv);
+    bool offline;  /* works on files only, the device is not opened */
+    bool structured;  /* prints records, so takes -F */
+    enum zl_bus_class bus;  /* priority under the bus scheduler (-B) */
+    const char *help;
+} commands[] = {
+    { "id",     cmd_id,     false, true,  ZL_BUS_MONITOR, "print chip identity (default)" },
+    { "poll",   cmd_poll,   false, true,  ZL_BUS_MONITOR, "sample registers periodically, to text or a capture file" },
+    { "steer",  cmd_steer,  false, false, ZL_BUS_STEER,   "write DPLL NCO frequency offsets (ppb) from stdin or a socket" },
+    { "refs",   cmd_refs,   false, true,  ZL_BUS_MONITOR, "print the monitor status of all input references" },
+    { "dplls",  cmd_dplls,  false, true,  ZL_BUS_MONITOR, "print lock state, selected reference and mode of all DPLLs" },
+    { "alarms", cmd_alarms, false, true,  ZL_BUS_ALARM,   "print and clear sticky reference and DPLL alarms as they latch" },
+    { "dump",   cmd_dump,   false, true,  ZL_BUS_BULK,    "print all registers, then only the byte ranges that change" },
+    { "mbox",   cmd_mbox,   false, true,  ZL_BUS_BULK,    "dump the mailbox configuration of refs, DPLLs, synths, outputs" },
+    { "config", cmd_config, false, false, ZL_BUS_BULK,    "export the chip configuration, or import it writing only changes" },
+    { "tune",   cmd_tune,   false, false, ZL_BUS_BULK,    "find the fastest reliable SPI speed, optionally save it" },
+    { "stress", cmd_stress, false, false, ZL_BUS_BULK,    "SPI bit error rate, throughput and latency at one speed" },
+    { "probe",  cmd_probe,  true,  false, ZL_BUS_BULK,    "detect and save the SPI mode of one or more device nodes" },
+    { "chips",  cmd_chips,  true,  false, ZL_BUS_BULK,    "list the known chip variants and their resources" },
+    { "bench",  cmd_bench,  true,  false, ZL_BUS_BULK,    "time bulk big-endian field decoding against the byte loop" },
+    { "read",   cmd_read,   true,  false, ZL_BUS_BULK,    "decode a time range of a capture file" },
+    { "arrow",  cmd_arrow,  true,  false, ZL_BUS_BULK,    "export a capture as an Arrow IPC stream, one column per register" },
+    { "merge",  cmd_merge,  true,  false, ZL_BUS_BULK,    "interleave several captures by timestamp" },
+    { "bus",    cmd_bus,    true,  true,  ZL_BUS_BULK,    "print the per-class statistics of the bus scheduler (-B)" },
+    { "sketch", cmd_sketch, true,  false, ZL_BUS_BULK,    "merge exported quantile sketches and print percentiles" },
+};
 
 static void
 usage(const char *prog)
 {
     fprintf(stderr,
-        "Usage: %s [-d /dev/spidevX.Y] [-s speed_hz] [-m 0..3] [-D debug_level]\n"
+        "Usage: %s [-d /dev/spidevX.Y] [-s speed_hz] [-m 0..3] [-D debug_level] [-S state] [-F format] [-B pct] [command [args]]\n"
         "  -d  spidev device (default %s)\n"
-        "  -s  SPI speed in Hz (default %u)\n"
+        "  -s  SPI speed in Hz (default: saved by tune, else %u)\n"
         "  -m  SPI mode 0..3 (default %d)\n"
         "  -D  debug of SPI transfers (default %d)\n"
+        "  -S  state file of saved per-device settings (default %s)\n"
+        "  -F  output format: text, json, jsonl or csv (default text)\n"
+        "  -B  share the bus with the other -B commands by priority, bulk work\n"
+        "      (dump, mbox, config...) using at most pct%% of the bus time\n"
+        "Commands (\"command -h\" for their options):\n"
         ,prog
         ,devnode
         ,speed_hz
         ,mode
         ,debug
+        ,state_path
     );
+    for (size_t i = 0; i < ARRAY_SIZE(commands); i++)
+        fprintf(stderr, "  %-6s %s\n", commands[i].name, commands[i].help);
 }
 
 int
@@ -202,19 +168,40 @@ main(int argc, char **argv)
         {"speed", required_argument, 0, 's'},
         {"mode", required_argument, 0, 'm'},
         {"debug", required_argument, 0, 'D'},
+        {"state", required_argument, 0, 'S'},
+        {"format", required_argument, 0, 'F'},
+        {"bus-budget", required_argument, 0, 'B'},
         {"help", no_argument, 0, 'h'},
         {}
     };
 
     int opt, optidx;
+    bool speed_set = false, mode_set = false;
+    unsigned int bus_budget = 0;
 
-    while ((opt = getopt_long(argc, argv, "d:s:m:D:h", long_opts, &optidx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "+d:s:m:D:S:F:B:h", long_opts, &optidx)) != -1) {
         switch (opt) {
         case 'd':
             devnode = optarg;
             break;
         case 's':
             speed_hz = (uint32_t)strtoul(optarg, NULL, 0);
+            speed_set = true;
+            break;
+        case 'S':
+            state_path = optarg;
+            break;
+        case 'F': {
+            int f = zl_format_parse(optarg);
+            if (f < 0)
+                errx(EXIT_FAILURE, "Invalid output format '%s', expected text, json, jsonl or csv", optarg);
+            out_format = (enum zl_format)f;
+            break;
+        }
+        case 'B':
+            bus_budget = (unsigned int)strtoul(optarg, NULL, 0);
+            if (bus_budget < 1 || bus_budget > 100)
+                errx(EXIT_FAILURE, "Invalid bus budget '%s', expected 1..100 (%%)", optarg);
             break;
         case 'm': {
             int m = atoi(optarg);
@@ -226,6 +213,7 @@ main(int argc, char **argv)
                 case 2: mode = SPI_MODE_2; break;
                 case 3: mode = SPI_MODE_3; break;
             }
+            mode_set = true;
             break;
         }
         case 'D':
@@ -238,59 +226,76 @@ main(int argc, char **argv)
         }
     }
 
-    int fd = open(devnode, O_RDWR);
+    const struct command *cmd = &commands[0];
 
-    if (fd < 0)
-        err(EXIT_FAILURE, "open %s failed", devnode); 
+    if (optind < argc) {
+        cmd = NULL;
+        for (size_t i = 0; i < ARRAY_SIZE(commands); i++) {
+            if (!strcmp(argv[optind], commands[i].name))
+                cmd = &commands[i];
+        }
+        if (!cmd) {
+            warnx("unknown command '%s'", argv[optind]);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    /* set spi bus settings */
-    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1)
-        err(EXIT_FAILURE, "SPI_IOC_WR_MODE(%d)", mode);
-    if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) == -1)
-        err(EXIT_FAILURE, "SPI_IOC_WR_BITS_PER_WORD(%d)", bits_per_word);
-    if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) == -1)
-        err(EXIT_FAILURE, "SPI_IOC_WR_MAX_SPEED_HZ(%u)", speed_hz);
+    if (out_format != ZL_FMT_TEXT && !cmd->structured)
+        errx(EXIT_FAILURE, "%s has no record output, -F is not supported", cmd->name);
+    zl_out_start();
 
-    uint16_t chip_id, fw_ver;
-    uint8_t revision;
-    uint32_t cfg_ver;
+    if (cmd->offline) {
+        int ret = cmd->run(-1, argc - optind, argv + optind);
 
-#define ZL_READ_REG(FD, REG, OUTVAR, LEN) do { \
-    size_t _len = (size_t)(LEN);                                                \
-    uint8_t _b[8];                                                              \
-    if (_len > sizeof(_b))                                                      \
-        errx(EXIT_FAILURE, #REG " read len %zu > %zu", _len, sizeof(_b));       \
-    if (_len > sizeof(OUTVAR))                                                  \
-        warnx(#REG " read len %zu > %zu for " #OUTVAR, _len, sizeof(OUTVAR));   \
-    if (zl_read_reg((FD), (REG), _b, _len) < 0)                                 \
-        errx(EXIT_FAILURE, "read %s failed", #REG);                             \
-    if (_len == 1) {                                                            \
-        (OUTVAR) = (typeof(OUTVAR))_b[0];                                       \
-    } else if (_len == 2) {                                                     \
-        uint16_t _t; memcpy(&_t, _b, 2);                                        \
-        (OUTVAR) = (typeof(OUTVAR))ntohs(_t);                                   \
-    } else if (_len == 4) {                                                     \
-        uint32_t _t; memcpy(&_t, _b, 4);                                        \
-        (OUTVAR) = (typeof(OUTVAR))ntohl(_t);                                   \
-    } else {                                                                    \
-        errx(EXIT_FAILURE, #REG " unsupported LEN=%zu (only 8,16,32 bits)", _len);\
-    }                                                                           \
-} while (0)
+        return zl_out_finish() < 0 ? EXIT_FAILURE : ret;
+    }
 
-    ZL_READ_REG(fd, ZL_REG_ID, chip_id, 2);
-    ZL_READ_REG(fd, ZL_REG_REVISION, revision, 1);
-    ZL_READ_REG(fd, ZL_REG_FW_VER, fw_ver, 2);
-    ZL_READ_REG(fd, ZL_REG_CUSTOM_CONFIG_VER, cfg_ver, 4);
+    if (bus_budget) {
+        int rc = zl_bus_open(devnode, cmd->bus, bus_budget);
 
-    /* done, print it */
-    printf("ZL3073x identity via %s\n", devnode);
-    printf("  Chip ID              : 0x%04X  (%s)\n", chip_id, lookup_name(chip_id));
-    printf("  Revision             : 0x%02X  (major=%u minor=%u)\n",
-           revision, (revision >> 4) & 0xF, revision & 0xF);
-    printf("  Firmware Version     : 0x%04X\n", fw_ver);
-    printf("  Custom Config Version: 0x%08X\n", cfg_ver);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "%s: bus scheduler: %s", devnode, strerror(-rc));
+    }
+
+    /* tuned speed, unless given or being tuned */
+    char val[16];
+
+    if (!speed_set && cmd->run != cmd_tune &&
+        zl_state_get(devnode, "speed_hz", val, sizeof(val)) == 0) {
+        speed_hz = (uint32_t)strtoul(val, NULL, 0);
+        if (debug > 0)
+            fprintf(stderr, "speed %u Hz from %s\n", speed_hz, state_path);
+    }
+
+    /* saved SPI mode, probed (and saved) when there is none */
+    if (!mode_set && zl_state_get(devnode, "mode", val, sizeof(val)) == 0) {
+        mode = (uint8_t)(strtoul(val, NULL, 0) & 3);
+    } else if (!mode_set) {
+        struct zl_probe probe = { .path = devnode };
+        uint32_t start_hz = speed_hz;
+
+        if (zl_probe(&probe, start_hz) == 0) {
+            mode = probe.mode;
+            /* a lower working speed is not used over an explicit -s */
+            if (speed_set)
+                probe.speed_hz = start_hz;
+            speed_hz = probe.speed_hz;
+            int rc = zl_probe_save(&probe, start_hz);
+
+            if (rc < 0)
+                warnx("cannot save the probed mode to %s: %s", state_path, strerror(-rc));
+        } else {
+            errx(EXIT_FAILURE, "%s: no known chip ID in any SPI mode, give it with -m", devnode);
+        }
+    }
+
+    int fd = zl_open(devnode);
+    int ret = cmd->run(fd, argc - optind, argv + optind);
 
     close(fd);
+    if (zl_out_finish() < 0)
+        ret = EXIT_FAILURE;
 
-    return EXIT_SUCCESS;
+    return ret;
 }
@@ -0,0 +1,433 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * ZL3073x register map and SPI access shared by the zl30733_id commands
+ *
+ * Notes:
+ * * Page size = 0x80; page select register = 0x7F (low nibble)
+ * * Register addresses below are (page << 7) | offset
+ * * Multi-byte fields are big-endian
+ */
+
+#ifndef ZL3073X_H
+#define ZL3073X_H
+
+#include <linux/spi/spidev.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
+#endif
+
+/* ZL3073x register map basics */
+#define ZL_PAGE_SIZE  0x80
+#define ZL_PAGE_SEL   0x7F
+#define ZL_NUM_PAGES  16
+
+#define ZL_REG(page, off) ((uint16_t)(((page) << 7) | (off)))
+#define ZL_REG_PAGE(reg)  (((reg) >> 7) & 0x0F)
+#define ZL_REG_OFF(reg)   ((reg) & 0x7F)
+
+#define ZL_MAX_CHANNELS   5
+#define ZL_NUM_REFS       10
+
+/* Identity block (page 0) */
+#define ZL_REG_ID                 0x0001  // u16, big-endian: Chip ID / family
+#define ZL_REG_REVISION           0x0003  // u8: single-byte stepping code (default 0x03 per
+                                          //     DS20006552M page-0 map). Reading 2 bytes here
+                                          //     pulls in the next register and prints garbage.
+#define ZL_REG_FW_VER             0x0005  // u16, big-endian
+#define ZL_REG_CUSTOM_CONFIG_VER  0x0007  // u32, big-endian
+
+/* Reference monitor status (page 2), one byte per reference, 0 = OK */
+#define ZL_REG_REF_MON_STATUS(n)     ZL_REG(2, 0x02 + (n))
+#define ZL_REF_MON_LOS               0x01  // loss of signal
+#define ZL_REF_MON_SCM               0x02  // single cycle monitor
+#define ZL_REF_MON_CFM               0x04  // coarse frequency monitor
+#define ZL_REF_MON_GST               0x08  // guard soak timer running
+#define ZL_REF_MON_PFM               0x10  // precise frequency monitor
+#define ZL_REF_MON_ESYNC             0x40  // eSync monitor
+
+/* DPLL status (page 2), one byte per channel */
+#define ZL_REG_DPLL_MON_STATUS(n)    ZL_REG(2, 0x10 + (n))
+#define ZL_DPLL_MON_STATE_MASK       0x03
+#define ZL_DPLL_MON_STATE_ACQUIRING  0
+#define ZL_DPLL_MON_STATE_LOCK       1
+#define ZL_DPLL_MON_STATE_HOLDOVER   2
+#define ZL_DPLL_MON_HO_READY         0x04
+#define ZL_REG_DPLL_REFSEL_STATUS(n) ZL_REG(2, 0x30 + (n))
+#define ZL_DPLL_REFSEL_REF_MASK      0x0F  // selected reference
+#define ZL_DPLL_REFSEL_STATE_SHIFT   4     // 3 bits: freerun, holdover, fastlock, acquiring, lock
+
+/*
+ * Sticky alarms (page 2): bits latch when the condition occurs and stay
+ * set until cleared by writing 1s. References and DPLL channels follow
+ * each other, so all of them are one block
+ */
+#define ZL_REG_REF_MON_STICKY(n)     ZL_REG(2, 0x20 + (n))  // ZL_REF_MON_* bits seen
+#define ZL_REG_DPLL_STICKY(n)        ZL_REG(2, 0x2A + (n))
+#define ZL_DPLL_STICKY_LOCK_LOSS     0x01
+#define ZL_DPLL_STICKY_HOLDOVER      0x02
+#define ZL_DPLL_STICKY_REF_SWITCH    0x04
+
+/* Reference frequency measurement (page 2 data, page 4 control) */
+#define ZL_REG_REF_FREQ(n)           ZL_REG(2, 0x44 + 4 * (n))  // s32 FFO, 2^-32 units
+#define ZL_REF_FREQ_LEN              4
+#define ZL_REG_REF_FREQ_MEAS_CTRL    ZL_REG(4, 0x1c)  // u8: command, clears when done
+#define ZL_REF_FREQ_MEAS_CTRL_MASK   0x03             //     0 = idle
+#define ZL_REF_FREQ_MEAS_CTRL_FFO    2                //     measure ref frequency offsets
+#define ZL_REG_REF_FREQ_MEAS_MASK    ZL_REG(4, 0x1d)  // 2 x u8: refs 0-7, then refs 8-9
+
+/* DPLL control (page 5) */
+#define ZL_REG_DPLL_MODE_REFSEL(n)  ZL_REG(5, 0x04 + 4 * (n))  // u8 per channel
+#define ZL_DPLL_MODE_MASK           0x07
+#define ZL_DPLL_MODE_REF_SHIFT      4     // forced reference in reflock mode
+#define ZL_DPLL_MODE_SPAN(nchan)    (4 * ((nchan) - 1) + 1)  // bytes covering nchan channels
+#define ZL_DPLL_MODE_FREERUN        0
+#define ZL_DPLL_MODE_HOLDOVER       1
+#define ZL_DPLL_MODE_REFLOCK        2
+#define ZL_DPLL_MODE_AUTO           3
+#define ZL_DPLL_MODE_NCO            4
+
+/* DPLL phase error measurement (page 5) */
+#define ZL_REG_DPLL_PHASE_ERR_READ_MASK  ZL_REG(5, 0x54)           // u8: channel mask, latches data
+#define ZL_REG_DPLL_PHASE_ERR_DATA(n)    ZL_REG(5, 0x55 + 6 * (n))  // s48, ps
+#define ZL_DPLL_PHASE_ERR_LEN            6
+
+/* DPLL NCO steering (page 6): dpll_df_offset_N, s48 in units of 2^-48 */
+#define ZL_REG_DPLL_DF_OFFSET(n)    ZL_REG(6, 0x08 * (n))
+#define ZL_DPLL_DF_OFFSET_LEN       6
+
+/*
+ * Configuration mailboxes: the object selected by the mask is loaded into
+ * (RD) or stored from (WR) the data registers of the page
+ */
+#define ZL_NUM_SYNTHS   5
+#define ZL_NUM_OUTPUTS  10
+#define ZL_MB_MAX_OBJS  10
+
+#define ZL_MB_MASK      0x02  // u16: one bit per object
+#define ZL_MB_SEM       0x04  // u8: command, cleared by the chip when done
+#define ZL_MB_SEM_WR    0x01
+#define ZL_MB_SEM_RD    0x02
+#define ZL_MB_DATA      0x05  // object data, up to the page select
+#define ZL_MB_DATA_LEN  (ZL_PAGE_SEL - ZL_MB_DATA)
+
+enum zl_mb_type {
+    ZL_MB_REF,      /* page 10 */
+    ZL_MB_DPLL,     /* page 12 */
+    ZL_MB_SYNTH,    /* page 13 */
+    ZL_MB_OUTPUT,   /* page 14 */
+    ZL_MB_NTYPES
+};
+
+/* Big-endian field of 1..8 bytes */
+static inline uint64_t
+zl_get_be(const uint8_t *p, size_t len)
+{
+    uint64_t v = 0;
+
+    for (size_t i = 0; i < len; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/* Big-endian two's complement 48-bit field, sign-extended */
+static inline int64_t
+zl_get_s48(const uint8_t *p)
+{
+    return (int64_t)(zl_get_be(p, 6) << 16) >> 16;
+}
+
+/* zl_be.c: n fields of width bytes, stride bytes apart, in one call */
+void zl_be_decode_u(uint64_t *out, const uint8_t *in, size_t n, size_t width, size_t stride);
+void zl_be_decode_s(int64_t *out, const uint8_t *in, size_t n, size_t width, size_t stride);
+
+/* A register (or contiguous register block) sampled by the polling mode */
+struct zl_watch {
+    uint16_t reg;
+    uint8_t len;
+};
+
+/* Longest single SPI read burst (tx/rx carry one extra address byte) */
+#define ZL_SPI_MAX_READ  255
+
+/* Largest block a single watch entry may span: one page minus the page select */
+#define ZL_WATCH_MAX_LEN  ZL_PAGE_SEL
+
+/* zl_out.c: structured output records (-F), one write() each */
+enum zl_format {
+    ZL_FMT_TEXT,
+    ZL_FMT_JSON,    /* one array of records */
+    ZL_FMT_JSONL,   /* one object per line */
+    ZL_FMT_CSV,     /* header line from the first record's keys */
+};
+
+#define ZL_REC_MAX  20480   /* a poll sample of 64 watches of a full page */
+
+struct zl_rec {
+    size_t len, hlen;
+    unsigned int nfields;
+    bool full;
+    char hdr[2048];
+    char buf[ZL_REC_MAX];
+};
+
+int zl_format_parse(const char *s);
+void zl_rec_begin(struct zl_rec *r);
+void zl_rec_str(struct zl_rec *r, const char *key, const char *val);
+void zl_rec_u64(struct zl_rec *r, const char *key, uint64_t val);
+void zl_rec_s64(struct zl_rec *r, const char *key, int64_t val);
+void zl_rec_bool(struct zl_rec *r, const char *key, bool val);
+void zl_rec_hex(struct zl_rec *r, const char *key, uint64_t val, size_t len);
+void zl_rec_bytes(struct zl_rec *r, const char *key, const uint8_t *p, size_t len);
+void zl_rec_ts(struct zl_rec *r, const char *key, uint64_t ns);
+int zl_rec_end(struct zl_rec *r);
+void zl_out_start(void);
+int zl_out_finish(void);
+
+/* Runtime settings (zl30733_id.c) */
+extern const char *devnode;
+extern const char *state_path;
+extern uint32_t speed_hz;
+extern uint8_t mode;
+extern uint8_t bits_per_word;
+extern int debug;
+extern enum zl_format out_format;
+
+/* zl_chips.c: per-variant resources, keyed by chip ID */
+struct zl_chip {
+    uint16_t id;
+    const char *name;
+    uint8_t channels, refs, synths, outputs;
+};
+
+const struct zl_chip *zl_chip_lookup(uint16_t id);
+const struct zl_chip *zl_chip_caps(uint16_t id);
+const char *zl_chip_name(uint16_t id);      /* NULL if unknown */
+
+/* zl_spi.c */
+void hexdump(const char *prefix, const uint8_t *buf, size_t len);
+int zl_open(const char *path);
+int spi_transfer(int fd, struct spi_ioc_transfer *xfer, unsigned int n);
+int spi_write_u8(int fd, uint8_t reg_off, uint8_t val);
+int spi_read(int fd, uint8_t reg_off, uint8_t *buf, size_t len);
+void spi_prefault(void);
+int zl_set_page(int fd, uint8_t page);
+int zl_read_reg(int fd, uint16_t reg, uint8_t *buf, size_t len);
+int zl_write_reg(int fd, uint16_t reg, const uint8_t *buf, size_t len);
+int zl_parse_watch(const char *arg, struct zl_watch *w);
+
+/* zl_sim.c: simulated register backend, device node "sim[:CHIP_ID]" */
+bool zl_sim_path(const char *path);
+int zl_sim_open(const char *path);
+bool zl_sim_fd(int fd);
+int zl_sim_transfer(const struct spi_ioc_transfer *xfer, unsigned int n);
+
+/* Subcommands */
+int cmd_poll(int fd, int argc, char **argv);   /* zl_poll.c */
+int cmd_read(int fd, int argc, char **argv);   /* zl_decode.c */
+int cmd_merge(int fd, int argc, char **argv);  /* zl_merge.c */
+int cmd_steer(int fd, int argc, char **argv);  /* zl_steer.c */
+int cmd_sketch(int fd, int argc, char **argv); /* zl_sketch.c */
+int cmd_refs(int fd, int argc, char **argv);   /* zl_refs.c */
+int cmd_dplls(int fd, int argc, char **argv);  /* zl_dplls.c */
+int cmd_mbox(int fd, int argc, char **argv);   /* zl_mbox.c */
+int cmd_config(int fd, int argc, char **argv); /* zl_config.c */
+int cmd_tune(int fd, int argc, char **argv);   /* zl_tune.c */
+int cmd_stress(int fd, int argc, char **argv); /* zl_tune.c */
+int cmd_probe(int fd, int argc, char **argv);  /* zl_probe.c */
+int cmd_chips(int fd, int argc, char **argv);  /* zl_chips.c */
+int cmd_alarms(int fd, int argc, char **argv); /* zl_alarms.c */
+int cmd_dump(int fd, int argc, char **argv);   /* zl_snap.c */
+int cmd_bench(int fd, int argc, char **argv);  /* zl_be.c */
+int cmd_arrow(int fd, int argc, char **argv);  /* zl_arrow.c */
+int cmd_bus(int fd, int argc, char **argv);    /* zl_bus.c */
+
+/* zl_rt.c: real-time setup and sample-interval jitter accounting */
+struct zl_jitter {
+    uint64_t interval_ns;   /* target */
+    uint64_t last_ns;
+    uint64_t n;
+    uint64_t late;          /* intervals longer than 1.5x the target */
+    int64_t min_ns, max_ns; /* deviation from the target */
+    double mean_ns, m2;
+};
+
+int zl_rt_enter(int cpu, int prio);
+uint64_t zl_now_ns(clockid_t clk);
+void zl_jitter_init(struct zl_jitter *j, uint64_t interval_ns);
+void zl_jitter_add(struct zl_jitter *j, uint64_t t_ns);
+void zl_jitter_report(const struct zl_jitter *j, const char *what);
+
+/* Latency histogram: 8 linear sub-buckets per power of two of ns */
+#define ZL_LAT_BUCKETS  (41 * 8)
+
+struct zl_lat {
+    uint64_t n, sum_ns, min_ns, max_ns;
+    uint32_t bucket[ZL_LAT_BUCKETS];
+};
+
+void zl_lat_init(struct zl_lat *l);
+void zl_lat_add(struct zl_lat *l, uint64_t ns);
+uint64_t zl_lat_quantile(const struct zl_lat *l, double q);
+uint64_t zl_lat_below(const struct zl_lat *l, unsigned int log2_ns);
+void zl_lat_report(const struct zl_lat *l, const char *what);
+
+/* zl_plan.c: register accesses planned once, submitted as one SPI message */
+#define ZL_PLAN_MAX_XFERS  128
+#define ZL_PLAN_BUF        4096    /* spidev default bufsiz per message */
+
+struct zl_plan {
+    unsigned int nxfer;
+    size_t len;             /* tx/rx bytes used */
+    int page;               /* page selected at this point of the plan */
+    bool last_read;
+    uint16_t last_end;      /* register following the last planned read */
+    struct spi_ioc_transfer xfer[ZL_PLAN_MAX_XFERS];
+    uint8_t tx[ZL_PLAN_BUF];
+    uint8_t rx[ZL_PLAN_BUF];
+};
+
+void zl_plan_init(struct zl_plan *p);
+int zl_plan_read(struct zl_plan *p, uint16_t reg, size_t len);
+int zl_plan_write(struct zl_plan *p, uint16_t reg, const uint8_t *data, size_t len);
+int zl_plan_submit(int fd, struct zl_plan *p);
+
+/* zl_refs.c: reference monitor status decoding */
+const char *zl_ref_name(unsigned int ref);
+size_t zl_ref_mon_format(char *buf, size_t size, uint8_t status);
+
+/* zl_dplls.c: DPLL channel status */
+size_t zl_dpll_format(char *buf, size_t size, uint8_t mon, uint8_t refsel, uint8_t ctrl);
+
+/* zl_mbox.c: mailbox engine */
+struct zl_mb_config {
+    unsigned int count[ZL_MB_NTYPES];   /* objects per type, 0 = skip */
+    uint8_t data[ZL_MB_NTYPES][ZL_MB_MAX_OBJS][ZL_MB_DATA_LEN];
+    unsigned long nmsg, npoll;          /* SPI messages, semaphore polls */
+};
+
+const char *zl_mb_name(unsigned int type);
+uint8_t zl_mb_page(unsigned int type);
+void zl_mb_counts(struct zl_mb_config *cfg, uint16_t chip_id);
+int zl_mb_read_all(int fd, struct zl_mb_config *cfg, bool pipelined);
+int zl_mb_write(int fd, struct zl_mb_config *cfg, const uint16_t *sel);
+
+/* zl_state.c: persistent per-device settings */
+int zl_state_get(const char *dev, const char *key, char *val, size_t size);
+int zl_state_set(const char *dev, const char *key, const char *val);
+
+/* zl_probe.c: SPI mode detection, cached in the state file */
+struct zl_probe {
+    const char *path;
+    uint8_t mode;
+    uint32_t speed_hz;
+    uint16_t chip_id;
+    int rc;             /* -ENODEV: no known chip ID in any mode */
+};
+
+int zl_probe(struct zl_probe *p, uint32_t start_hz);
+int zl_probe_save(const struct zl_probe *p, uint32_t start_hz);
+
+/* zl_alarms.c: sticky alarm harvesting, the read is in the caller's plan */
+#define ZL_ALARM_MAX  (ZL_NUM_REFS + ZL_MAX_CHANNELS)
+
+struct zl_alarm_event {
+    uint64_t ts;
+    bool dpll;          /* else a reference */
+    uint8_t index;
+    uint8_t bits;
+};
+
+struct zl_alarms {
+    size_t len;         /* sticky bytes: the references, then the channels */
+    unsigned long nreads, nevents, nclears;   /* clears are one message each */
+    struct zl_plan clear;
+};
+
+void zl_alarms_init(struct zl_alarms *a, unsigned int nchan);
+int zl_alarms_harvest(int fd, struct zl_alarms *a, const uint8_t *sticky, uint64_t ts,
+                      struct zl_alarm_event *ev);
+size_t zl_alarm_format(char *buf, size_t size, const struct zl_alarm_event *ev);
+
+/* zl_gpio.c: interrupt line events, "gpiochipN:LINE" */
+struct zl_gpio {
+    int line_fd, epoll_fd;
+};
+
+int zl_gpio_open(struct zl_gpio *g, const char *spec, bool active_high);
+void zl_gpio_close(struct zl_gpio *g);
+int zl_gpio_wait(struct zl_gpio *g, int timeout_ms, uint64_t *ts);
+int zl_gpio_active(struct zl_gpio *g);
+
+/* zl_snap.c: full register image (page select bytes left 0) and its changes */
+#define ZL_SNAP_LEN  (ZL_NUM_PAGES * ZL_PAGE_SIZE)
+
+struct zl_range {
+    uint16_t start, len;
+};
+
+size_t zl_snap_diff(const uint8_t *a, const uint8_t *b, size_t len, struct zl_range *r, size_t max);
+
+/* zl_bus.c: SPI bus scheduler shared by the processes on one device (-B) */
+enum zl_bus_class {
+    ZL_BUS_STEER,       /* highest priority */
+    ZL_BUS_ALARM,
+    ZL_BUS_MONITOR,
+    ZL_BUS_BULK,        /* preempted between pages, limited to the budget */
+    ZL_BUS_NCLASS,
+};
+
+int zl_bus_open(const char *dev, enum zl_bus_class cls, unsigned int budget_pct);
+void zl_bus_begin(void);
+void zl_bus_end(void);
+bool zl_bus_preemptible(void);
+
+/* zl_net.c: "unix:PATH", "HOST:PORT" or "PORT" (loopback) */
+int zl_socket_bind(const char *spec, int socktype);
+
+/* zl_steer.c: NCO frequency steering through one prebuilt SPI message */
+struct zl_steer {
+    int fd;
+    uint8_t page_tx[2];
+    uint8_t data_tx[1 + ZL_DPLL_DF_OFFSET_LEN];
+    struct spi_ioc_transfer xfer[2];
+};
+
+int64_t zl_ppb_to_df(double ppb);
+int zl_steer_init(struct zl_steer *s, int fd, unsigned int channel);
+int zl_steer_write(struct zl_steer *s, double ppb);
+
+/* zl_metrics.c: text metrics of the polling loop, served from its last snapshot */
+#define ZL_METRICS_MAX_PHASE  ZL_MAX_CHANNELS
+
+struct zl_metrics_phase {
+    unsigned int chan;
+    int64_t last_ps, min_ps, max_ps;
+    double mean_ps, m2;
+    uint64_t n;
+};
+
+struct zl_metrics_snap {
+    uint64_t ts_ns, samples, late;
+    uint64_t messages, transfers, bytes;    /* SPI traffic of the loop */
+    uint16_t chip_id;
+    unsigned int nchan;
+    uint8_t ref_status[ZL_NUM_REFS];
+    uint8_t dpll_mon[ZL_MAX_CHANNELS], dpll_refsel[ZL_MAX_CHANNELS], dpll_mode[ZL_MAX_CHANNELS];
+    size_t nphase;                          /* --tie channels */
+    struct zl_metrics_phase phase[ZL_METRICS_MAX_PHASE];
+    bool alarms;
+    uint64_t nalarms;
+    struct zl_lat spi_lat;
+};
+
+int zl_metrics_start(const char *spec);
+void zl_metrics_publish(const struct zl_metrics_snap *s);
+void zl_metrics_stop(void);
+
+#endif /* ZL3073X_H */
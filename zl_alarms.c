@@ -0,0 +1,302 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Sticky alarm harvesting
+ * - The sticky bytes of all references and DPLL channels are one block:
+ *   the read is planned into the caller's message (one coalesced burst)
+ * - Only when bits were found set, one more message writes them back
+ *   (write-1-to-clear) over the span from the first to the last set
+ *   byte; bytes read as 0 in between clear nothing
+ * - Each set byte becomes an event stamped with the read time, so a
+ *   polling loop costs one ioctl per cycle, two when alarms fired
+ * - With -g, the alarms command sleeps on the interrupt line instead and
+ *   harvests when it asserts (stamped with the kernel's edge time), with
+ *   a slow watchdog harvest in case an edge is missed
+ * - The line is driven by the sticky bits themselves (there is no separate
+ *   interrupt status to acknowledge), so the sticky read is the status
+ *   read and clearing it releases the line. A line still asserted with
+ *   nothing latched is reported, as its source is then elsewhere
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zl3073x.h"
+
+_Static_assert(ZL_REG_DPLL_STICKY(0) == ZL_REG_REF_MON_STICKY(ZL_NUM_REFS),
+               "sticky registers must form one block");
+
+static const struct {
+    uint8_t mask;
+    const char *name;
+} dpll_sticky_bits[] = {
+    { ZL_DPLL_STICKY_LOCK_LOSS,  "LOCK-LOSS" },
+    { ZL_DPLL_STICKY_HOLDOVER,   "HOLDOVER" },
+    { ZL_DPLL_STICKY_REF_SWITCH, "REF-SWITCH" },
+};
+
+/* The caller reads a->len bytes at ZL_REG_REF_MON_STICKY(0) in its plan */
+void
+zl_alarms_init(struct zl_alarms *a, unsigned int nchan)
+{
+    a->len = ZL_NUM_REFS + nchan;
+    a->nreads = a->nevents = a->nclears = 0;
+}
+
+/* Events of the sticky bytes read into ev[ZL_ALARM_MAX], then clear them */
+int
+zl_alarms_harvest(int fd, struct zl_alarms *a, const uint8_t *sticky, uint64_t ts,
+                  struct zl_alarm_event *ev)
+{
+    size_t first = a->len, last = 0;
+    int n = 0;
+
+    a->nreads++;
+    for (size_t i = 0; i < a->len; i++) {
+        if (!sticky[i])
+            continue;
+        if (first == a->len)
+            first = i;
+        last = i;
+        ev[n++] = (struct zl_alarm_event){
+            .ts = ts,
+            .dpll = i >= ZL_NUM_REFS,
+            .index = (uint8_t)(i >= ZL_NUM_REFS ? i - ZL_NUM_REFS : i),
+            .bits = sticky[i],
+        };
+    }
+    if (!n)
+        return 0;
+
+    zl_plan_init(&a->clear);
+    if (zl_plan_write(&a->clear, (uint16_t)(ZL_REG_REF_MON_STICKY(0) + first),
+                      sticky + first, last - first + 1) < 0 ||
+        zl_plan_submit(fd, &a->clear) < 0)
+        return -EIO;
+    a->nclears++;
+    a->nevents += (unsigned long)n;
+
+    return n;
+}
+
+/* "REF3P: LOS|SCM" or "dpll1: LOCK-LOSS"; returns the length */
+size_t
+zl_alarm_format(char *buf, size_t size, const struct zl_alarm_event *ev)
+{
+    size_t n;
+
+    if (!size)
+        return 0;
+    if (!ev->dpll) {
+        n = (size_t)snprintf(buf, size, "%s: ", zl_ref_name(ev->index));
+        if (n < size)
+            n += zl_ref_mon_format(buf + n, size - n, ev->bits);
+        return n < size ? n : size - 1;
+    }
+
+    n = (size_t)snprintf(buf, size, "dpll%u: ", ev->index);
+
+    size_t start = n;
+
+    for (size_t i = 0; i < ARRAY_SIZE(dpll_sticky_bits) && n < size; i++) {
+        if (ev->bits & dpll_sticky_bits[i].mask)
+            n += (size_t)snprintf(buf + n, size - n, "%s%s", n > start ? "|" : "",
+                                  dpll_sticky_bits[i].name);
+    }
+    if (n == start && n < size)
+        n += (size_t)snprintf(buf + n, size - n, "0x%02X", ev->bits);
+    return n < size ? n : size - 1;
+}
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* One message reading the sticky block, a second one if alarms are cleared */
+static int
+alarms_cycle(int fd, struct zl_plan *plan, int rx, struct zl_alarms *al, uint64_t ts)
+{
+    struct zl_alarm_event ev[ZL_ALARM_MAX];
+    char line[96];
+
+    if (zl_plan_submit(fd, plan) < 0)
+        errx(EXIT_FAILURE, "sticky alarm read failed");
+
+    int nev = zl_alarms_harvest(fd, al, plan->rx + rx, ts, ev);
+
+    if (nev < 0)
+        errx(EXIT_FAILURE, "sticky alarm clear failed");
+    for (int i = 0; i < nev; i++) {
+        zl_alarm_format(line, sizeof(line), &ev[i]);
+        if (out_format != ZL_FMT_TEXT) {
+            static struct zl_rec rec;
+
+            zl_rec_begin(&rec);
+            zl_rec_ts(&rec, "ts", ev[i].ts);
+            zl_rec_str(&rec, "source", ev[i].dpll ? "dpll" : "ref");
+            zl_rec_u64(&rec, "index", ev[i].index);
+            zl_rec_hex(&rec, "bits", ev[i].bits, 1);
+            zl_rec_str(&rec, "alarm", line);
+            if (zl_rec_end(&rec) < 0)
+                errx(EXIT_FAILURE, "write alarm record failed");
+            continue;
+        }
+        printf("%llu.%09llu %s\n", (unsigned long long)(ev[i].ts / 1000000000u),
+               (unsigned long long)(ev[i].ts % 1000000000u), line);
+    }
+    if (nev && out_format == ZL_FMT_TEXT)
+        fflush(stdout);
+
+    return nev;
+}
+
+static void
+alarms_usage(void)
+{
+    fprintf(stderr,
+        "Usage: alarms [-i interval_us] [-n count] [-g gpiochipN:LINE [-H] [-W s]] [-v]\n"
+        "  -i  harvest interval in microseconds (default 100000)\n"
+        "  -n  number of harvests or wakeups, 0 = until interrupted (default 0)\n"
+        "  -g  wait for the interrupt line on this GPIO instead of polling\n"
+        "  -H  the interrupt line is active high (default active low)\n"
+        "  -W  watchdog harvest period in seconds with -g (default 1)\n"
+        "  -v  print message counts on exit\n"
+        "Prints each latched alarm with its time, and clears it\n"
+    );
+}
+
+int
+cmd_alarms(int fd, int argc, char **argv)
+{
+    static struct zl_plan plan;
+    static struct zl_alarms al;
+    struct zl_gpio gpio = { -1, -1 };
+    const char *gpio_spec = NULL;
+    uint32_t interval_us = 100000;
+    unsigned long count = 0, n, edges = 0, watchdogs = 0, stuck = 0;
+    double watchdog_s = 1;
+    bool verbose = false, active_high = false;
+    uint8_t id[2];
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "i:n:g:HW:vh")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_us = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            gpio_spec = optarg;
+            break;
+        case 'H':
+            active_high = true;
+            break;
+        case 'W':
+            watchdog_s = strtod(optarg, NULL);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            alarms_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || interval_us == 0 || watchdog_s <= 0) {
+        alarms_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (zl_read_reg(fd, ZL_REG_ID, id, sizeof(id)) < 0)
+        errx(EXIT_FAILURE, "read ZL_REG_ID failed");
+
+    zl_alarms_init(&al, zl_chip_caps((uint16_t)((id[0] << 8) | id[1]))->channels);
+    zl_plan_init(&plan);
+
+    int rx = zl_plan_read(&plan, ZL_REG_REF_MON_STICKY(0), al.len);
+
+    if (rx < 0)
+        errx(EXIT_FAILURE, "cannot plan the sticky alarm read");
+
+    if (gpio_spec) {
+        int rc = zl_gpio_open(&gpio, gpio_spec, active_high);
+
+        if (rc < 0)
+            errx(EXIT_FAILURE, "request interrupt line %s: %s", gpio_spec, strerror(-rc));
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct timespec next;
+
+    /* alarms already latched hold the line asserted: no edge would come */
+    if (gpio_spec)
+        alarms_cycle(fd, &plan, rx, &al, zl_now_ns(CLOCK_REALTIME));
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (n = 0; !stop && (count == 0 || n < count); n++) {
+        uint64_t ts = zl_now_ns(CLOCK_REALTIME);
+
+        if (!gpio_spec) {
+            alarms_cycle(fd, &plan, rx, &al, ts);
+
+            next.tv_nsec += (long)(interval_us % 1000000u) * 1000;
+            next.tv_sec += interval_us / 1000000u + next.tv_nsec / 1000000000;
+            next.tv_nsec %= 1000000000;
+            while (!stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+                ;
+            continue;
+        }
+
+        int rc = zl_gpio_wait(&gpio, (int)(watchdog_s * 1000), &ts);
+
+        if (rc == -EINTR)
+            continue;
+        if (rc < 0)
+            errx(EXIT_FAILURE, "wait for interrupt line %s: %s", gpio_spec, strerror(-rc));
+        if (rc > 0) {
+            edges += (unsigned long)rc;
+        } else {
+            watchdogs++;
+            ts = zl_now_ns(CLOCK_REALTIME);
+        }
+
+        /* alarms latched between the read and the clear keep the line asserted */
+        int nev = alarms_cycle(fd, &plan, rx, &al, ts);
+
+        for (int k = 0; nev > 0 && k < 8 && zl_gpio_active(&gpio) == 1; k++)
+            nev = alarms_cycle(fd, &plan, rx, &al, zl_now_ns(CLOCK_REALTIME));
+        if (nev == 0 && zl_gpio_active(&gpio) == 1 && !stuck++)
+            warnx("interrupt line %s asserted with no sticky alarm set", gpio_spec);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "alarms: %lu reads, %lu events, %lu messages", al.nreads,
+                al.nevents, al.nreads + al.nclears);
+        if (gpio_spec)
+            fprintf(stderr, ", %lu edges, %lu watchdog wakeups, %lu stuck", edges, watchdogs,
+                    stuck);
+        fprintf(stderr, "\n");
+    }
+    zl_gpio_close(&gpio);
+
+    return EXIT_SUCCESS;
+}
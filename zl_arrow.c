@@ -0,0 +1,501 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Capture export as an Arrow IPC stream
+ * - Columns: "ts" (timestamp[ns, UTC]), then one per watched register:
+ *   unsigned integers of 8 to 64 bits for fields of up to 8 bytes (raw
+ *   register value), fixed-size binary for longer blocks
+ * - Records are decoded block by block into fixed-size record batches
+ *   (bulk big-endian decode straight from the mapping, stride = record
+ *   size); a full batch is written and its buffers reused, so memory is
+ *   bounded by the batch size whatever the capture length
+ * - Only the IPC subset needed is written: one Schema message, then
+ *   RecordBatch messages without nulls, dictionaries or compression, then
+ *   the end-of-stream marker. The flatbuffer metadata is laid out front
+ *   to back: a vtable just before each table, and every object after the
+ *   offset that points to it
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zl3073x.h"
+#include "zl_capture.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "column buffers are written in host order, Arrow IPC here is little-endian"
+#endif
+
+#define ARROW_META_MAX      16384
+#define ARROW_VERSION_V5    4
+#define ARROW_MSG_SCHEMA    1
+#define ARROW_MSG_BATCH     3
+#define ARROW_TYPE_INT      2
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_TYPE_FIXED_BINARY 15
+#define ARROW_UNIT_NS       3
+
+/* Flatbuffer built front to back */
+struct fb {
+    size_t len;
+    bool full;
+    uint8_t buf[ARROW_META_MAX];
+};
+
+struct arrow_col {
+    size_t off;         /* in the record payload */
+    uint8_t len;        /* register bytes */
+    uint8_t width;      /* column bytes per value */
+    bool binary;
+    uint8_t *data;
+};
+
+struct arrow_writer {
+    FILE *f;
+    size_t ncol;        /* watch columns, after ts */
+    size_t rows, max_rows;
+    unsigned long nbatches;
+    uint64_t nrows, nbytes;
+    uint64_t *ts;
+    struct arrow_col col[ZL_CAP_MAX_WATCH];
+    struct fb meta;
+};
+
+static size_t
+fb_put(struct fb *b, const void *p, size_t n)
+{
+    size_t pos = b->len;
+
+    if (b->len + n > sizeof(b->buf)) {
+        b->full = true;
+        return pos;
+    }
+    if (p)
+        memcpy(b->buf + b->len, p, n);
+    else
+        memset(b->buf + b->len, 0, n);
+    b->len += n;
+    return pos;
+}
+
+/* Pad with zeros until len % align == mod */
+static void
+fb_pad(struct fb *b, size_t align, size_t mod)
+{
+    while (b->len % align != mod && !b->full)
+        fb_put(b, NULL, 1);
+}
+
+static void
+fb_set(struct fb *b, size_t pos, uint64_t v, size_t size)
+{
+    for (size_t i = 0; i < size && pos + i < b->len; i++)
+        b->buf[pos + i] = (uint8_t)(v >> (8 * i));
+}
+
+static size_t
+fb_put_le(struct fb *b, uint64_t v, size_t size)
+{
+    size_t pos = fb_put(b, NULL, size);
+
+    fb_set(b, pos, v, size);
+    return pos;
+}
+
+/* Point the offset at slot to the object at target (always after it) */
+static void
+fb_patch(struct fb *b, size_t slot, size_t target)
+{
+    fb_set(b, slot, target - slot, 4);
+}
+
+/*
+ * Table of n fields of size[i] bytes (0 = absent, 4 for offsets patched
+ * later) set to val[i]; larger fields first, so all are aligned. Returns
+ * the table position, the field positions in slot[]
+ */
+static size_t
+fb_table(struct fb *b, unsigned int n, const uint8_t *size, const uint64_t *val, size_t *slot)
+{
+    uint16_t off[8] = { 0 }, inl = 4;
+
+    for (unsigned int s = 8; s; s >>= 1) {
+        for (unsigned int i = 0; i < n; i++) {
+            if (size[i] == s) {
+                off[i] = inl;
+                inl = (uint16_t)(inl + s);
+            }
+        }
+    }
+
+    fb_pad(b, 2, 0);
+
+    size_t vt = fb_put_le(b, 4 + 2 * n, 2);
+
+    fb_put_le(b, inl, 2);
+    for (unsigned int i = 0; i < n; i++)
+        fb_put_le(b, off[i], 2);
+
+    /* 8-byte fields start right after the vtable offset */
+    fb_pad(b, 8, 4);
+
+    size_t t = fb_put_le(b, b->len - vt, 4);
+
+    fb_put(b, NULL, inl - 4u);
+    for (unsigned int i = 0; i < n; i++) {
+        slot[i] = t + off[i];
+        if (size[i])
+            fb_set(b, slot[i], val[i], size[i]);
+    }
+    return t;
+}
+
+/* Vector header of count elements aligned to align; elements follow */
+static size_t
+fb_vector(struct fb *b, uint32_t count, size_t align)
+{
+    fb_pad(b, align, align - 4);
+    return fb_put_le(b, count, 4);
+}
+
+static size_t
+fb_string(struct fb *b, const char *s)
+{
+    size_t len = strlen(s);
+
+    fb_pad(b, 4, 0);
+
+    size_t pos = fb_put_le(b, len, 4);
+
+    fb_put(b, s, len);
+    fb_put(b, NULL, 1);
+    return pos;
+}
+
+/* Message table with its header offset left in *header */
+static void
+arrow_message(struct fb *b, uint8_t type, uint64_t body_len, size_t *header)
+{
+    static const uint8_t size[] = { 2, 1, 4, 8 };
+    uint64_t val[] = { ARROW_VERSION_V5, type, 0, body_len };
+    size_t slot[4];
+
+    b->len = 0;
+    b->full = false;
+    fb_put(b, NULL, 4);
+    fb_patch(b, 0, fb_table(b, 4, size, val, slot));
+    *header = slot[2];
+}
+
+/* Continuation marker, metadata size, metadata padded to 8 bytes */
+static int
+arrow_write_meta(struct arrow_writer *w)
+{
+    struct fb *b = &w->meta;
+    uint32_t prefix[2] = { 0xFFFFFFFFu, 0 };
+
+    fb_pad(b, 8, 0);
+    if (b->full)
+        return -EMSGSIZE;
+    prefix[1] = (uint32_t)b->len;
+    if (fwrite(prefix, sizeof(prefix), 1, w->f) != 1 || fwrite(b->buf, b->len, 1, w->f) != 1)
+        return -EIO;
+    w->nbytes += sizeof(prefix) + b->len;
+    return 0;
+}
+
+static void
+arrow_field(struct fb *b, size_t elem, const char *name, const struct arrow_col *c)
+{
+    static const uint8_t size[] = { 4, 1, 1, 4, 0, 4 };
+    uint64_t val[6] = { 0 };
+    size_t slot[6], tslot[2];
+
+    val[2] = !c ? ARROW_TYPE_TIMESTAMP : c->binary ? ARROW_TYPE_FIXED_BINARY : ARROW_TYPE_INT;
+    fb_patch(b, elem, fb_table(b, 6, size, val, slot));
+    fb_patch(b, slot[0], fb_string(b, name));
+
+    if (!c) {
+        static const uint8_t tsize[] = { 2, 4 };
+        const uint64_t tval[] = { ARROW_UNIT_NS, 0 };
+
+        fb_patch(b, slot[3], fb_table(b, 2, tsize, tval, tslot));
+        fb_patch(b, tslot[1], fb_string(b, "UTC"));
+    } else if (c->binary) {
+        static const uint8_t tsize[] = { 4 };
+        const uint64_t tval[] = { c->len };
+
+        fb_patch(b, slot[3], fb_table(b, 1, tsize, tval, tslot));
+    } else {
+        static const uint8_t tsize[] = { 4, 1 };
+        const uint64_t tval[] = { 8u * c->width, 0 };
+
+        fb_patch(b, slot[3], fb_table(b, 2, tsize, tval, tslot));
+    }
+    fb_patch(b, slot[5], fb_vector(b, 0, 4));
+}
+
+static int
+arrow_schema(struct arrow_writer *w, const struct zl_cap *cap)
+{
+    static const uint8_t size[] = { 2, 4 };
+    static const uint64_t val[] = { 0, 0 };
+    struct fb *b = &w->meta;
+    size_t header, slot[2];
+
+    arrow_message(b, ARROW_MSG_SCHEMA, 0, &header);
+    fb_patch(b, header, fb_table(b, 2, size, val, slot));
+
+    size_t vec = fb_vector(b, (uint32_t)(1 + w->ncol), 4);
+
+    fb_patch(b, slot[1], vec);
+    fb_put(b, NULL, 4 * (1 + w->ncol));
+    arrow_field(b, vec + 4, "ts", NULL);
+    for (size_t i = 0; i < w->ncol; i++) {
+        char name[8];
+
+        snprintf(name, sizeof(name), "0x%04X", cap->watch[i].reg);
+        arrow_field(b, vec + 8 + 4 * i, name, &w->col[i]);
+    }
+    return arrow_write_meta(w);
+}
+
+static size_t
+arrow_pad8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+/* Write the rows staged so far as one record batch */
+static int
+arrow_flush(struct arrow_writer *w)
+{
+    static const uint8_t zero[8];
+    static const uint8_t size[] = { 8, 4, 4 };
+    uint64_t val[] = { w->rows, 0, 0 };
+    struct fb *b = &w->meta;
+    size_t ncol = 1 + w->ncol, header, slot[3], body = 0;
+
+    if (!w->rows)
+        return 0;
+
+    /* values were decoded as u64: narrow in place to the column width */
+    for (size_t i = 0; i < w->ncol; i++) {
+        struct arrow_col *c = &w->col[i];
+
+        for (size_t r = 0; !c->binary && c->width < 8 && r < w->rows; r++)
+            memmove(c->data + r * c->width, c->data + r * 8, c->width);
+    }
+
+    body = arrow_pad8(w->rows * 8);
+    for (size_t i = 0; i < w->ncol; i++)
+        body += arrow_pad8(w->rows * w->col[i].width);
+
+    arrow_message(b, ARROW_MSG_BATCH, body, &header);
+    fb_patch(b, header, fb_table(b, 3, size, val, slot));
+
+    fb_patch(b, slot[1], fb_vector(b, (uint32_t)ncol, 8));
+    for (size_t i = 0; i < ncol; i++) {
+        fb_put_le(b, w->rows, 8);   /* length */
+        fb_put_le(b, 0, 8);         /* null count */
+    }
+
+    /* validity bitmaps are empty: no nulls */
+    size_t off = 0;
+
+    fb_patch(b, slot[2], fb_vector(b, (uint32_t)(2 * ncol), 8));
+    for (size_t i = 0; i < ncol; i++) {
+        size_t len = w->rows * (i ? w->col[i - 1].width : 8);
+
+        fb_put_le(b, off, 8);
+        fb_put_le(b, 0, 8);
+        fb_put_le(b, off, 8);
+        fb_put_le(b, len, 8);
+        off += arrow_pad8(len);
+    }
+
+    int rc = arrow_write_meta(w);
+
+    if (rc < 0)
+        return rc;
+    for (size_t i = 0; i < ncol; i++) {
+        const void *data = i ? (const void *)w->col[i - 1].data : (const void *)w->ts;
+        size_t len = w->rows * (i ? w->col[i - 1].width : 8);
+
+        if (fwrite(data, 1, len, w->f) != len ||
+            fwrite(zero, 1, arrow_pad8(len) - len, w->f) != arrow_pad8(len) - len)
+            return -EIO;
+    }
+
+    w->nbytes += body;
+    w->nrows += w->rows;
+    w->nbatches++;
+    w->rows = 0;
+    return 0;
+}
+
+/* Stage records [r0, r1) of a block, flushing full batches */
+static int
+arrow_add(struct arrow_writer *w, const struct zl_cap *cap, const uint8_t *recs,
+          size_t r0, size_t r1)
+{
+    while (r0 < r1) {
+        size_t k = r1 - r0 < w->max_rows - w->rows ? r1 - r0 : w->max_rows - w->rows;
+        const uint8_t *rec = recs + r0 * cap->rec_size;
+
+        for (size_t r = 0; r < k; r++)
+            w->ts[w->rows + r] = zl_cap_rec_ts(rec + r * cap->rec_size);
+        for (size_t i = 0; i < w->ncol; i++) {
+            struct arrow_col *c = &w->col[i];
+            const uint8_t *p = rec + sizeof(uint64_t) + c->off;
+
+            if (!c->binary) {
+                zl_be_decode_u((uint64_t *)c->data + w->rows, p, k, c->len, cap->rec_size);
+                continue;
+            }
+            for (size_t r = 0; r < k; r++)
+                memcpy(c->data + (w->rows + r) * c->len, p + r * cap->rec_size, c->len);
+        }
+        w->rows += k;
+        r0 += k;
+
+        if (w->rows == w->max_rows) {
+            int rc = arrow_flush(w);
+
+            if (rc < 0)
+                return rc;
+        }
+    }
+    return 0;
+}
+
+static void
+arrow_usage(void)
+{
+    fprintf(stderr,
+        "Usage: arrow [-f from] [-t to] [-b rows] [-o file] [-v] capture\n"
+        "  -f  first timestamp: epoch seconds, UTC YYYY-MM-DDTHH:MM:SS[.frac]\n"
+        "  -t  last timestamp, same forms or +SECONDS after -f\n"
+        "  -b  rows per record batch (default 65536)\n"
+        "  -o  output file (default stdout)\n"
+        "  -v  report rows, batches and bytes on stderr\n"
+        "Exports a capture as an Arrow IPC stream, one column per register\n"
+    );
+}
+
+int
+cmd_arrow(int fd, int argc, char **argv)
+{
+    static struct arrow_writer w;
+    const char *from_s = NULL, *to_s = NULL, *output = NULL;
+    uint64_t from = 0, to = UINT64_MAX;
+    bool verbose = false;
+    struct zl_cap cap;
+    int opt, rc;
+
+    (void)fd;
+    w.max_rows = 65536;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "f:t:b:o:vh")) != -1) {
+        switch (opt) {
+        case 'f':
+            from_s = optarg;
+            break;
+        case 't':
+            to_s = optarg;
+            break;
+        case 'b':
+            w.max_rows = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            arrow_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || w.max_rows == 0) {
+        arrow_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (from_s && zl_parse_time(from_s, 0, &from) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", from_s);
+    if (to_s && zl_parse_time(to_s, from, &to) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", to_s);
+
+    rc = zl_cap_open(&cap, argv[optind]);
+    if (rc < 0)
+        errx(EXIT_FAILURE, "open capture %s: %s", argv[optind], strerror(-rc));
+
+    w.f = output ? fopen(output, "wb") : stdout;
+    if (!w.f)
+        err(EXIT_FAILURE, "open %s", output);
+
+    w.ncol = cap.nwatch;
+    w.ts = malloc(w.max_rows * sizeof(*w.ts));
+    if (!w.ts)
+        err(EXIT_FAILURE, "malloc");
+    for (size_t i = 0, off = 0; i < w.ncol; off += cap.watch[i++].len) {
+        struct arrow_col *c = &w.col[i];
+
+        c->off = off;
+        c->len = cap.watch[i].len;
+        c->binary = c->len > 8;
+        c->width = c->binary ? c->len : c->len <= 1 ? 1 : c->len <= 2 ? 2 : c->len <= 4 ? 4 : 8;
+        /* integer columns are decoded as u64, then narrowed */
+        c->data = malloc(w.max_rows * (c->binary ? c->len : 8));
+        if (!c->data)
+            err(EXIT_FAILURE, "malloc");
+    }
+
+    rc = arrow_schema(&w, &cap);
+    for (size_t b = zl_cap_seek(&cap, from); rc == 0 && b < cap.nblocks; b++) {
+        const struct zl_cap_block *blk = &cap.idx[b];
+        size_t r0 = 0, r1 = blk->nrec;
+
+        if (blk->first_ns > to)
+            break;
+        while (r0 < r1 && zl_cap_rec_ts(blk->recs + r0 * cap.rec_size) < from)
+            r0++;
+        while (r1 > r0 && zl_cap_rec_ts(blk->recs + (r1 - 1) * cap.rec_size) > to)
+            r1--;
+        rc = arrow_add(&w, &cap, blk->recs, r0, r1);
+    }
+    if (rc == 0)
+        rc = arrow_flush(&w);
+
+    /* end of stream: continuation marker and a zero length */
+    static const uint32_t eos[2] = { 0xFFFFFFFFu, 0 };
+
+    if (rc == 0 && fwrite(eos, sizeof(eos), 1, w.f) != 1)
+        rc = -EIO;
+    if ((output ? fclose(w.f) : fflush(w.f)) != 0 && rc == 0)
+        rc = -EIO;
+    if (rc < 0)
+        errx(EXIT_FAILURE, "write Arrow stream %s: %s", output ? output : "(stdout)",
+             strerror(-rc));
+
+    if (verbose)
+        fprintf(stderr, "arrow: %llu rows in %lu batches, %llu bytes\n",
+                (unsigned long long)w.nrows, w.nbatches,
+                (unsigned long long)(w.nbytes + sizeof(eos)));
+
+    for (size_t i = 0; i < w.ncol; i++)
+        free(w.col[i].data);
+    free(w.ts);
+    zl_cap_close(&cap);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,212 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Bulk big-endian field decoding
+ * - Fields of 1..8 bytes, stride bytes apart (records of a capture, or a
+ *   contiguous register block), are decoded into 64-bit values
+ * - Each field is one unaligned 8-byte load from its first byte, a byte
+ *   reversal and a shift right by the unused bytes: arithmetic for signed
+ *   fields, so the sign extension is free. Two fields per step go through
+ *   SSE2 (x86) or NEON (AArch64) registers; other targets use bswap
+ * - The load reads past a field, so the last fields whose 8 bytes would
+ *   run past the buffer are decoded byte by byte
+ * - "bench" compares this with the byte loop of zl_get_be()
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "zl3073x.h"
+
+/* Fields of the n that can be loaded 8 bytes at a time */
+static size_t
+be_wide(size_t n, size_t width, size_t stride)
+{
+    size_t total = (n - 1) * stride + width;
+
+    if (total < 8)
+        return 0;
+
+    size_t k = (total - 8) / stride + 1;
+
+    return k < n ? k : n;
+}
+
+static void
+be_decode(uint64_t *out, const uint8_t *in, size_t n, size_t width, size_t stride,
+          bool is_signed)
+{
+    unsigned int shift = 64 - 8 * (unsigned int)width;
+    size_t wide, i = 0;
+
+    if (!n)
+        return;
+    wide = be_wide(n, width, stride);
+
+#if defined(__SSE2__)
+    /* no 64-bit arithmetic shift: shift logically, then sign-extend */
+    __m128i sh = _mm_cvtsi32_si128((int)shift);
+    __m128i sign = _mm_set1_epi64x(is_signed && width < 8 ? (long long)(1ull << (8 * width - 1)) : 0);
+
+    for (; i + 2 <= wide; i += 2) {
+        __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(in + i * stride)),
+                                       _mm_loadl_epi64((const __m128i *)(in + (i + 1) * stride)));
+
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B);
+        v = _mm_srl_epi64(v, sh);
+        v = _mm_sub_epi64(_mm_xor_si128(v, sign), sign);
+        _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    int64x2_t sh = vdupq_n_s64(-(int64_t)shift);
+
+    for (; i + 2 <= wide; i += 2) {
+        uint8x16_t b = vcombine_u8(vld1_u8(in + i * stride), vld1_u8(in + (i + 1) * stride));
+        uint64x2_t v = vreinterpretq_u64_u8(vrev64q_u8(b));
+
+        if (is_signed)
+            v = vreinterpretq_u64_s64(vshlq_s64(vreinterpretq_s64_u64(v), sh));
+        else
+            v = vshlq_u64(v, sh);
+        vst1q_u64(out + i, v);
+    }
+#endif
+    for (; i < wide; i++) {
+        uint64_t v;
+
+        memcpy(&v, in + i * stride, sizeof(v));
+        v = __builtin_bswap64(v);
+        out[i] = is_signed ? (uint64_t)((int64_t)v >> shift) : v >> shift;
+    }
+    for (; i < n; i++) {
+        uint64_t v = zl_get_be(in + i * stride, width);
+
+        out[i] = is_signed && shift ? (uint64_t)((int64_t)(v << shift) >> shift) : v;
+    }
+}
+
+/* n unsigned fields of width bytes, stride bytes apart */
+void
+zl_be_decode_u(uint64_t *out, const uint8_t *in, size_t n, size_t width, size_t stride)
+{
+    be_decode(out, in, n, width, stride, false);
+}
+
+/* Same, two's complement */
+void
+zl_be_decode_s(int64_t *out, const uint8_t *in, size_t n, size_t width, size_t stride)
+{
+    be_decode((uint64_t *)out, in, n, width, stride, true);
+}
+
+static void
+bench_usage(void)
+{
+    fprintf(stderr,
+        "Usage: bench [-n fields] [-r rounds] [-s stride]\n"
+        "  -n  fields per buffer (default 4096)\n"
+        "  -r  decodes of the buffer per measurement (default 1000)\n"
+        "  -s  bytes between fields, 0 = packed (default 0)\n"
+        "Times bulk big-endian decoding against the per-field byte loop\n"
+    );
+}
+
+int
+cmd_bench(int fd, int argc, char **argv)
+{
+    static const unsigned int widths[] = { 2, 4, 6, 8 };
+    size_t nfields = 4096, stride = 0;
+    unsigned long rounds = 1000;
+    int opt, ret = EXIT_SUCCESS;
+
+    (void)fd;
+    optind = 0;
+    while ((opt = getopt(argc, argv, "n:r:s:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nfields = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            stride = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+        default:
+            bench_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || nfields == 0 || rounds == 0 || (stride && stride < 8)) {
+        bench_usage();
+        return EXIT_FAILURE;
+    }
+
+    size_t maxstride = stride ? stride : 8;
+    uint8_t *buf = malloc(nfields * maxstride);
+    int64_t *ref = malloc(nfields * sizeof(*ref));
+    int64_t *out = malloc(nfields * sizeof(*out));
+
+    if (!buf || !ref || !out)
+        err(EXIT_FAILURE, "malloc");
+    for (size_t i = 0; i < nfields * maxstride; i++)
+        buf[i] = (uint8_t)(i * 0x9E3779B1u >> 13);
+
+    printf("%-6s %-8s %12s %12s %8s\n", "WIDTH", "TYPE", "LOOP_NS/FLD", "BULK_NS/FLD", "SPEEDUP");
+    for (size_t w = 0; w < ARRAY_SIZE(widths); w++) {
+        size_t st = stride ? stride : widths[w];
+
+        for (int sgn = 0; sgn < 2; sgn++) {
+            unsigned int shift = 64 - 8 * widths[w];
+            uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+
+            for (unsigned long r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < nfields; i++) {
+                    uint64_t v = zl_get_be(buf + i * st, widths[w]);
+
+                    ref[i] = sgn && shift ? (int64_t)(v << shift) >> shift : (int64_t)v;
+                }
+                __asm__ volatile("" : : "r"(ref) : "memory");
+            }
+
+            uint64_t t1 = zl_now_ns(CLOCK_MONOTONIC);
+
+            for (unsigned long r = 0; r < rounds; r++) {
+                if (sgn)
+                    zl_be_decode_s(out, buf, nfields, widths[w], st);
+                else
+                    zl_be_decode_u((uint64_t *)out, buf, nfields, widths[w], st);
+                __asm__ volatile("" : : "r"(out) : "memory");
+            }
+
+            uint64_t t2 = zl_now_ns(CLOCK_MONOTONIC);
+            double loop = (double)(t1 - t0) / ((double)rounds * (double)nfields);
+            double bulk = (double)(t2 - t1) / ((double)rounds * (double)nfields);
+
+            if (memcmp(ref, out, nfields * sizeof(*out))) {
+                warnx("%u-byte %s fields decode differently", widths[w], sgn ? "signed" : "unsigned");
+                ret = EXIT_FAILURE;
+            }
+            printf("%-6u %-8s %12.3f %12.3f %7.1fx\n", 8 * widths[w], sgn ? "signed" : "unsigned",
+                   loop, bulk, bulk > 0 ? loop / bulk : 0);
+        }
+    }
+
+    free(out);
+    free(ref);
+    free(buf);
+    return ret;
+}
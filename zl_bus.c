@@ -0,0 +1,446 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * SPI bus scheduler shared by the processes using one device node (-B)
+ * - Each command runs in a priority class: steering > alarms > monitoring
+ *   > bulk. A transaction (one SPI message, or the page select and access
+ *   of zl_read_reg()/zl_write_reg()) holds the bus; when it ends, the
+ *   highest class waiting gets it next
+ * - Preemption is between transactions: bulk plans are submitted one page
+ *   at a time (zl_plan_submit()), so a steering write waits for one page
+ *   rather than a whole dump
+ * - Bulk transactions also draw their bus time from a token bucket
+ *   refilled at the budget percentage, and wait while it is empty
+ * - The arbiter is POSIX shared memory named after the device node: a
+ *   robust, priority-inheriting process-shared mutex, the waiting
+ *   processes (dead ones are reaped), and per-class transaction counts,
+ *   bus time and queueing latency, printed by "bus"
+ * - Waiters sleep on a futex counting the hand-overs rather than on a
+ *   condition variable, whose shared state a killed waiter can wedge
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+#define BUS_MAGIC     0x7A6C6273u   /* "zlbs" */
+#define BUS_WAITERS   32
+#define BUS_REAP_NS   10000000u     /* dead owner/waiter check while waiting */
+#define BUS_WINDOW_NS 100000000u    /* bulk burst: budget share of 100 ms */
+
+static const char *const class_names[ZL_BUS_NCLASS] = {
+    [ZL_BUS_STEER]   = "steer",
+    [ZL_BUS_ALARM]   = "alarm",
+    [ZL_BUS_MONITOR] = "monitor",
+    [ZL_BUS_BULK]    = "bulk",
+};
+
+struct bus_class_stats {
+    uint64_t txns, busy_ns;
+    uint64_t throttled;             /* bulk waits for budget */
+    struct zl_lat queue;            /* request to grant */
+};
+
+struct bus_shm {
+    uint32_t magic, size;
+    pthread_mutex_t lock;
+    uint32_t handovers;             /* futex word of the waiters */
+    pid_t owner;                    /* 0 while the bus is free */
+    uint32_t budget_pct;
+    int64_t tokens_ns;
+    uint64_t refill_ns, start_ns;
+    struct {
+        pid_t pid;
+        uint8_t cls;
+    } waiter[BUS_WAITERS];
+    struct bus_class_stats cls[ZL_BUS_NCLASS];
+};
+
+static struct {
+    struct bus_shm *shm;
+    enum zl_bus_class cls;
+    unsigned int depth;
+    uint64_t grant_ns;
+    pid_t pid;
+} bus;
+
+static void
+bus_shm_name(char *name, size_t size, const char *dev)
+{
+    size_t n = (size_t)snprintf(name, size, "/zl30733_id.bus.%s", dev);
+
+    for (size_t i = 1; i < n && i < size; i++) {
+        if (name[i] == '/')
+            name[i] = '_';
+    }
+}
+
+static struct bus_shm *
+bus_map(const char *dev, bool create, int *rc)
+{
+    char name[NAME_MAX];
+    struct stat sb;
+    bool creator = false;
+    int fd;
+
+    bus_shm_name(name, sizeof(name), dev);
+    fd = create ? shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600) : -1;
+    if (fd >= 0)
+        creator = true;
+    else if (!create || errno == EEXIST)
+        fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        *rc = -errno;
+        return NULL;
+    }
+
+    /* an attaching process may see the area before the creator sized it */
+    for (int i = 0; !creator; i++) {
+        if (fstat(fd, &sb) < 0 || i == 100) {
+            close(fd);
+            *rc = -ETIMEDOUT;
+            return NULL;
+        }
+        if (sb.st_size)
+            break;
+        usleep(10000);
+    }
+    if (creator ? ftruncate(fd, sizeof(struct bus_shm)) < 0
+                : (size_t)sb.st_size != sizeof(struct bus_shm)) {
+        *rc = creator ? -errno : -EPROTO;   /* other tool version */
+        close(fd);
+        return NULL;
+    }
+
+    struct bus_shm *s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+    if (s == MAP_FAILED) {
+        *rc = -errno;
+        return NULL;
+    }
+
+    if (creator) {
+        pthread_mutexattr_t ma;
+
+        pthread_mutexattr_init(&ma);
+        pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+        pthread_mutexattr_setprotocol(&ma, PTHREAD_PRIO_INHERIT);
+        pthread_mutex_init(&s->lock, &ma);
+        pthread_mutexattr_destroy(&ma);
+        s->budget_pct = 100;
+        s->start_ns = s->refill_ns = zl_now_ns(CLOCK_MONOTONIC);
+        for (unsigned int c = 0; c < ZL_BUS_NCLASS; c++)
+            zl_lat_init(&s->cls[c].queue);
+        s->size = sizeof(*s);
+        __atomic_store_n(&s->magic, BUS_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        for (int i = 0; __atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != BUS_MAGIC; i++) {
+            if (i == 100) {
+                munmap(s, sizeof(*s));
+                *rc = -ETIMEDOUT;
+                return NULL;
+            }
+            usleep(10000);
+        }
+    }
+
+    *rc = 0;
+    return s;
+}
+
+static void
+bus_lock(struct bus_shm *s)
+{
+    /* a process died holding the lock: the state it guards stays usable */
+    if (pthread_mutex_lock(&s->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&s->lock);
+}
+
+/* Wake the waiters to re-check the bus (with the lock held) */
+static void
+bus_wake(struct bus_shm *s)
+{
+    __atomic_add_fetch(&s->handovers, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &s->handovers, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static bool
+bus_alive(pid_t pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* Forget the bus owner and the waiters that exited without letting go */
+static void
+bus_reap(struct bus_shm *s)
+{
+    bool wake = false;
+
+    if (s->owner && !bus_alive(s->owner)) {
+        s->owner = 0;
+        wake = true;
+    }
+    for (unsigned int i = 0; i < BUS_WAITERS; i++) {
+        if (s->waiter[i].pid && !bus_alive(s->waiter[i].pid)) {
+            s->waiter[i].pid = 0;
+            wake = true;
+        }
+    }
+    if (wake)
+        bus_wake(s);
+}
+
+static bool
+bus_higher_waiting(const struct bus_shm *s, enum zl_bus_class cls)
+{
+    for (unsigned int i = 0; i < BUS_WAITERS; i++) {
+        if (s->waiter[i].pid && s->waiter[i].cls < cls)
+            return true;
+    }
+    return false;
+}
+
+/* Bulk bus time available, ns; negative once the budget is overdrawn */
+static int64_t
+bus_refill(struct bus_shm *s, uint64_t now)
+{
+    int64_t burst = (int64_t)BUS_WINDOW_NS / 100 * s->budget_pct;
+
+    s->tokens_ns += (int64_t)((now - s->refill_ns) / 100 * s->budget_pct);
+    if (s->tokens_ns > burst)
+        s->tokens_ns = burst;
+    s->refill_ns = now;
+
+    return s->tokens_ns;
+}
+
+/* Use the bus scheduler of dev from now on; -errno on failure */
+int
+zl_bus_open(const char *dev, enum zl_bus_class cls, unsigned int budget_pct)
+{
+    int rc;
+    struct bus_shm *s = bus_map(dev, true, &rc);
+
+    if (!s)
+        return rc;
+    if (budget_pct) {
+        bus_lock(s);
+        s->budget_pct = budget_pct > 100 ? 100 : budget_pct;
+        pthread_mutex_unlock(&s->lock);
+    }
+    bus.shm = s;
+    bus.cls = cls;
+    bus.pid = getpid();
+
+    return 0;
+}
+
+/* Start a transaction: wait for the bus, after any higher class waiting */
+void
+zl_bus_begin(void)
+{
+    struct bus_shm *s = bus.shm;
+
+    if (!s || bus.depth++)
+        return;
+
+    uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC), now = t0;
+    bool throttled = false;
+    int slot = -1;
+
+    bus_lock(s);
+    for (unsigned int i = 0; i < BUS_WAITERS; i++) {
+        if (!s->waiter[i].pid) {
+            s->waiter[i].pid = bus.pid;
+            s->waiter[i].cls = (uint8_t)bus.cls;
+            slot = (int)i;
+            break;
+        }
+    }
+
+    for (;;) {
+        uint64_t wait_ns = BUS_REAP_NS;
+
+        if (!s->owner && !bus_higher_waiting(s, bus.cls)) {
+            int64_t tokens;
+
+            if (bus.cls != ZL_BUS_BULK || (tokens = bus_refill(s, now)) > 0)
+                break;
+            /* over budget: sleep until the bucket refills */
+            throttled = true;
+            wait_ns = (uint64_t)(-tokens) * 100 / s->budget_pct + 1;
+            if (wait_ns > BUS_REAP_NS)
+                wait_ns = BUS_REAP_NS;
+        }
+
+        uint32_t seen = s->handovers;
+        struct timespec ts = {
+            .tv_sec = (time_t)(wait_ns / 1000000000u),
+            .tv_nsec = (long)(wait_ns % 1000000000u),
+        };
+
+        pthread_mutex_unlock(&s->lock);
+        long rc = syscall(SYS_futex, &s->handovers, FUTEX_WAIT, seen, &ts, NULL, 0);
+        bool timedout = rc < 0 && errno == ETIMEDOUT;
+
+        bus_lock(s);
+        if (timedout)
+            bus_reap(s);
+        now = zl_now_ns(CLOCK_MONOTONIC);
+    }
+
+    if (slot >= 0)
+        s->waiter[slot].pid = 0;
+    s->owner = bus.pid;
+    s->cls[bus.cls].txns++;
+    s->cls[bus.cls].throttled += throttled;
+    zl_lat_add(&s->cls[bus.cls].queue, now - t0);
+    pthread_mutex_unlock(&s->lock);
+
+    bus.grant_ns = now;
+    if (debug > 0)
+        fprintf(stderr, "BUS: %s granted after %.1f us\n", class_names[bus.cls],
+                (double)(now - t0) / 1e3);
+}
+
+/* End the transaction and hand the bus over */
+void
+zl_bus_end(void)
+{
+    struct bus_shm *s = bus.shm;
+
+    if (!s || --bus.depth)
+        return;
+
+    uint64_t busy = zl_now_ns(CLOCK_MONOTONIC) - bus.grant_ns;
+
+    bus_lock(s);
+    s->cls[bus.cls].busy_ns += busy;
+    if (bus.cls == ZL_BUS_BULK)
+        s->tokens_ns -= (int64_t)busy;
+    if (s->owner == bus.pid)
+        s->owner = 0;
+    bus_wake(s);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* True when long messages should be cut into transactions */
+bool
+zl_bus_preemptible(void)
+{
+    return bus.shm && bus.cls == ZL_BUS_BULK && !bus.depth;
+}
+
+static void
+bus_usage(void)
+{
+    fprintf(stderr,
+        "Usage: bus [-r]\n"
+        "  -r  reset the statistics after printing them\n"
+        "Prints the per-class statistics of the bus scheduler of the device\n"
+        "node (-d), as shared by the commands run with -B\n"
+    );
+}
+
+int
+cmd_bus(int fd, int argc, char **argv)
+{
+    static struct bus_class_stats st[ZL_BUS_NCLASS];
+    bool reset = false;
+    int opt, rc;
+
+    (void)fd;
+    optind = 0;
+    while ((opt = getopt(argc, argv, "rh")) != -1) {
+        switch (opt) {
+        case 'r':
+            reset = true;
+            break;
+        case 'h':
+        default:
+            bus_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        bus_usage();
+        return EXIT_FAILURE;
+    }
+
+    struct bus_shm *s = bus_map(devnode, false, &rc);
+
+    if (!s) {
+        if (rc == -ENOENT)
+            errx(EXIT_FAILURE, "%s: no command has used the bus scheduler (-B)", devnode);
+        errx(EXIT_FAILURE, "%s: bus scheduler: %s", devnode, strerror(-rc));
+    }
+
+    uint64_t now = zl_now_ns(CLOCK_MONOTONIC);
+
+    bus_lock(s);
+    memcpy(st, s->cls, sizeof(st));
+    uint64_t elapsed = now - s->start_ns;
+    unsigned int budget = s->budget_pct;
+    pid_t owner = s->owner;
+
+    if (reset) {
+        memset(s->cls, 0, sizeof(s->cls));
+        for (unsigned int c = 0; c < ZL_BUS_NCLASS; c++)
+            zl_lat_init(&s->cls[c].queue);
+        s->start_ns = now;
+    }
+    pthread_mutex_unlock(&s->lock);
+    munmap(s, sizeof(*s));
+
+    if (out_format == ZL_FMT_TEXT) {
+        printf("%s: bulk budget %u%%, %.3f s of statistics, bus %s\n", devnode, budget,
+               (double)elapsed / 1e9, owner ? "busy" : "free");
+        printf("%-8s %10s %10s %6s %9s %10s %10s %10s\n", "CLASS", "TXNS", "BUS_MS", "UTIL%",
+               "THROTTLED", "Q_P50_US", "Q_P99_US", "Q_MAX_US");
+    }
+    for (unsigned int c = 0; c < ZL_BUS_NCLASS; c++) {
+        const struct zl_lat *q = &st[c].queue;
+        double util = elapsed ? 100.0 * (double)st[c].busy_ns / (double)elapsed : 0;
+
+        if (out_format != ZL_FMT_TEXT) {
+            static struct zl_rec rec;
+
+            zl_rec_begin(&rec);
+            zl_rec_str(&rec, "class", class_names[c]);
+            zl_rec_u64(&rec, "txns", st[c].txns);
+            zl_rec_u64(&rec, "busy_ns", st[c].busy_ns);
+            zl_rec_u64(&rec, "elapsed_ns", elapsed);
+            zl_rec_u64(&rec, "throttled", st[c].throttled);
+            zl_rec_u64(&rec, "queue_p50_ns", zl_lat_quantile(q, 0.5));
+            zl_rec_u64(&rec, "queue_p99_ns", zl_lat_quantile(q, 0.99));
+            zl_rec_u64(&rec, "queue_max_ns", q->max_ns);
+            if (zl_rec_end(&rec) < 0)
+                errx(EXIT_FAILURE, "write bus record failed");
+            continue;
+        }
+        printf("%-8s %10llu %10.3f %6.2f %9llu %10.1f %10.1f %10.1f\n", class_names[c],
+               (unsigned long long)st[c].txns, (double)st[c].busy_ns / 1e6, util,
+               (unsigned long long)st[c].throttled, zl_lat_quantile(q, 0.5) / 1e3,
+               zl_lat_quantile(q, 0.99) / 1e3, q->max_ns / 1e3);
+    }
+
+    return EXIT_SUCCESS;
+}
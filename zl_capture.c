@@ -0,0 +1,379 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Capture files: block writer used by the polling mode and the offline
+ * memory-mapped reader (see zl_capture.h for the layout)
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+#include "zl_capture.h"
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int
+zl_cap_create(struct zl_cap_writer *w, const char *path,
+              const struct zl_watch *watch, size_t nwatch,
+              uint16_t chip_id, uint32_t interval_us)
+{
+    static uint8_t hdrbuf[ZL_CAP_HDR_SIZE];
+    struct zl_cap_file_hdr *hdr = (struct zl_cap_file_hdr *)hdrbuf;
+    uint32_t rec_size = sizeof(uint64_t);
+    int rc;
+
+    if (nwatch == 0 || nwatch > ZL_CAP_MAX_WATCH)
+        return -EINVAL;
+
+    memset(hdrbuf, 0, sizeof(hdrbuf));
+    memcpy(hdr->magic, ZL_CAP_MAGIC, sizeof(hdr->magic));
+    for (size_t i = 0; i < nwatch; i++) {
+        hdr->watch[i].reg = htole16(watch[i].reg);
+        hdr->watch[i].len = watch[i].len;
+        rec_size += watch[i].len;
+    }
+    hdr->version = htole32(ZL_CAP_VERSION);
+    hdr->hdr_size = htole32(ZL_CAP_HDR_SIZE);
+    hdr->block_size = htole32(ZL_CAP_BLOCK_SIZE);
+    hdr->rec_size = htole32(rec_size);
+    hdr->interval_us = htole32(interval_us);
+    hdr->chip_id = htole16(chip_id);
+    hdr->nwatch = htole16((uint16_t)nwatch);
+    snprintf(hdr->devnode, sizeof(hdr->devnode), "%s", devnode);
+
+    memset(w, 0, sizeof(*w));
+    w->rec_size = rec_size;
+    w->max_rec = (ZL_CAP_BLOCK_SIZE - sizeof(struct zl_cap_block_hdr)) / rec_size;
+    w->blk = malloc(ZL_CAP_BLOCK_SIZE);
+    if (!w->blk)
+        return -ENOMEM;
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        rc = -errno;
+        free(w->blk);
+        return rc;
+    }
+
+    rc = write_full(w->fd, hdrbuf, sizeof(hdrbuf));
+    if (rc) {
+        close(w->fd);
+        free(w->blk);
+    }
+    return rc;
+}
+
+/* Reserve the next record; returns where the register bytes go, or NULL */
+uint8_t *
+zl_cap_append(struct zl_cap_writer *w, uint64_t ts_ns)
+{
+    if (w->nrec == w->max_rec && zl_cap_flush(w) < 0)
+        return NULL;
+
+    uint8_t *rec = w->blk + sizeof(struct zl_cap_block_hdr) +
+                   (size_t)w->nrec * w->rec_size;
+    uint64_t le = htole64(ts_ns);
+
+    memcpy(rec, &le, sizeof(le));
+    if (w->nrec == 0)
+        w->first_ns = ts_ns;
+    w->last_ns = ts_ns;
+    w->nrec++;
+
+    return rec + sizeof(le);
+}
+
+int
+zl_cap_flush(struct zl_cap_writer *w)
+{
+    struct zl_cap_block_hdr bh = {
+        .magic = htole32(ZL_CAP_BLOCK_MAGIC),
+        .nrec = htole32(w->nrec),
+        .first_ns = htole64(w->first_ns),
+        .last_ns = htole64(w->last_ns),
+    };
+    size_t used = sizeof(bh) + (size_t)w->nrec * w->rec_size;
+
+    if (w->nrec == 0)
+        return 0;
+
+    memcpy(w->blk, &bh, sizeof(bh));
+    memset(w->blk + used, 0, ZL_CAP_BLOCK_SIZE - used);
+    w->nrec = 0;
+
+    return write_full(w->fd, w->blk, ZL_CAP_BLOCK_SIZE);
+}
+
+int
+zl_cap_finish(struct zl_cap_writer *w)
+{
+    int rc = zl_cap_flush(w);
+
+    if (close(w->fd) < 0 && !rc)
+        rc = -errno;
+    free(w->blk);
+    w->blk = NULL;
+
+    return rc;
+}
+
+uint64_t
+zl_cap_rec_ts(const uint8_t *rec)
+{
+    uint64_t le;
+
+    memcpy(&le, rec, sizeof(le));
+    return le64toh(le);
+}
+
+int
+zl_cap_open(struct zl_cap *c, const char *path)
+{
+    struct zl_cap_file_hdr hdr;
+    struct stat st;
+    int rc;
+
+    memset(c, 0, sizeof(*c));
+    c->fd = open(path, O_RDONLY);
+    if (c->fd < 0)
+        return -errno;
+    if (fstat(c->fd, &st) < 0) {
+        rc = -errno;
+        goto fail;
+    }
+    if ((size_t)st.st_size < ZL_CAP_HDR_SIZE) {
+        rc = -EINVAL;
+        goto fail;
+    }
+
+    c->size = (size_t)st.st_size;
+    c->map = mmap(NULL, c->size, PROT_READ, MAP_SHARED, c->fd, 0);
+    if (c->map == MAP_FAILED) {
+        rc = -errno;
+        c->map = NULL;
+        goto fail;
+    }
+    /* the index scan touches one page per block: no readahead wanted */
+    madvise((void *)c->map, c->size, MADV_RANDOM);
+
+    memcpy(&hdr, c->map, sizeof(hdr));
+    if (memcmp(hdr.magic, ZL_CAP_MAGIC, sizeof(hdr.magic)) ||
+        le32toh(hdr.version) != ZL_CAP_VERSION) {
+        rc = -EINVAL;
+        goto fail;
+    }
+
+    uint32_t hdr_size = le32toh(hdr.hdr_size);
+    uint32_t block_size = le32toh(hdr.block_size);
+    uint32_t rec_size = sizeof(uint64_t);
+
+    c->nwatch = le16toh(hdr.nwatch);
+    if (c->nwatch == 0 || c->nwatch > ZL_CAP_MAX_WATCH ||
+        block_size <= sizeof(struct zl_cap_block_hdr) || hdr_size > c->size) {
+        rc = -EINVAL;
+        goto fail;
+    }
+    for (size_t i = 0; i < c->nwatch; i++) {
+        c->watch[i].reg = le16toh(hdr.watch[i].reg);
+        c->watch[i].len = hdr.watch[i].len;
+        rec_size += c->watch[i].len;
+    }
+    if (rec_size != le32toh(hdr.rec_size)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+    c->rec_size = rec_size;
+    c->block_size = block_size;
+    c->interval_us = le32toh(hdr.interval_us);
+    c->chip_id = le16toh(hdr.chip_id);
+    memcpy(c->devnode, hdr.devnode, sizeof(c->devnode));
+    c->devnode[sizeof(c->devnode) - 1] = '\0';
+
+    size_t maxblocks = (c->size - hdr_size) / block_size;
+    uint32_t max_rec = (block_size - sizeof(struct zl_cap_block_hdr)) / rec_size;
+
+    c->idx = calloc(maxblocks ? maxblocks : 1, sizeof(*c->idx));
+    if (!c->idx) {
+        rc = -ENOMEM;
+        goto fail;
+    }
+
+    /* Build the block index; stop at the first torn or foreign block */
+    for (size_t b = 0; b < maxblocks; b++) {
+        const uint8_t *p = c->map + hdr_size + b * block_size;
+        struct zl_cap_block_hdr bh;
+
+        memcpy(&bh, p, sizeof(bh));
+        uint32_t nrec = le32toh(bh.nrec);
+        if (le32toh(bh.magic) != ZL_CAP_BLOCK_MAGIC || nrec == 0 || nrec > max_rec)
+            break;
+
+        c->idx[b].first_ns = le64toh(bh.first_ns);
+        c->idx[b].last_ns = le64toh(bh.last_ns);
+        c->idx[b].recs = p + sizeof(bh);
+        c->idx[b].nrec = nrec;
+        c->nblocks++;
+    }
+
+    return 0;
+
+fail:
+    zl_cap_close(c);
+    return rc;
+}
+
+void
+zl_cap_close(struct zl_cap *c)
+{
+    if (c->map)
+        munmap((void *)c->map, c->size);
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c->idx);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+/*
+ * First block that may hold a record at or after ts_ns (binary search on
+ * the block index, assumes the capture clock did not step backwards).
+ * Returns c->nblocks when every record is older.
+ */
+size_t
+zl_cap_seek(const struct zl_cap *c, uint64_t ts_ns)
+{
+    size_t lo = 0, hi = c->nblocks;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (c->idx[mid].last_ns < ts_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Upper bound of a zl_format_sample() line for this watchlist */
+size_t
+zl_sample_line_max(const struct zl_watch *watch, size_t nwatch)
+{
+    size_t n = 32;
+
+    for (size_t i = 0; i < nwatch; i++)
+        n += 12 + 2 * (size_t)watch[i].len;
+    return n;
+}
+
+/* One text line per sample: "<sec>.<nsec> REG=VALUE ..." */
+size_t
+zl_format_sample(char *buf, size_t size, uint64_t ts_ns,
+                 const struct zl_watch *watch, size_t nwatch,
+                 const uint8_t *payload)
+{
+    size_t n = 0;
+
+#define APPEND(...) do {                                                 \
+        int _r = snprintf(buf + n, n < size ? size - n : 0, __VA_ARGS__);   \
+        if (_r > 0)                                                      \
+            n += (size_t)_r;                                             \
+    } while (0)
+
+    APPEND("%" PRIu64 ".%09" PRIu64, ts_ns / 1000000000u, ts_ns % 1000000000u);
+    for (size_t i = 0; i < nwatch; i++) {
+        APPEND(" 0x%04X=", watch[i].reg);
+        if (watch[i].len <= 8) {
+            uint64_t v = 0;
+            for (size_t k = 0; k < watch[i].len; k++)
+                v = (v << 8) | payload[k];
+            APPEND("0x%0*" PRIX64, watch[i].len * 2, v);
+        } else {
+            for (size_t k = 0; k < watch[i].len; k++)
+                APPEND("%02X", payload[k]);
+        }
+        payload += watch[i].len;
+    }
+    APPEND("\n");
+
+#undef APPEND
+
+    return n < size ? n : size - 1;
+}
+
+/*
+ * Accepted forms: epoch seconds ("1760629685.5"), UTC date
+ * ("2025-10-16T15:48:05[.5][Z]"), or "+SECONDS" relative to base_ns.
+ */
+int
+zl_parse_time(const char *s, uint64_t base_ns, uint64_t *ns)
+{
+    uint64_t sec, rel, frac = 0;
+    const char *p;
+    char *end;
+
+    if (*s == '+') {
+        if (!base_ns)
+            return -EINVAL;
+        if (zl_parse_time(s + 1, 0, &rel) < 0)
+            return -EINVAL;
+        *ns = base_ns + rel;
+        return 0;
+    }
+
+    if (strlen(s) >= 10 && s[4] == '-' && s[7] == '-') {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        p = strptime(s, (s[10] == ' ') ? "%Y-%m-%d %H:%M:%S" : "%Y-%m-%dT%H:%M:%S", &tm);
+        if (!p)
+            return -EINVAL;
+        sec = (uint64_t)timegm(&tm);
+    } else {
+        sec = strtoull(s, &end, 10);
+        if (end == s)
+            return -EINVAL;
+        p = end;
+    }
+
+    if (*p == '.') {
+        uint64_t scale = 100000000u;
+        for (p++; *p >= '0' && *p <= '9'; p++) {
+            frac += (uint64_t)(*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (*p == 'Z')
+        p++;
+    if (*p != '\0')
+        return -EINVAL;
+
+    *ns = sec * 1000000000u + frac;
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Binary capture files written by the polling mode
+ *
+ * Layout (all header fields little-endian):
+ * * File header, padded to ZL_CAP_HDR_SIZE
+ * * Fixed-size blocks of ZL_CAP_BLOCK_SIZE bytes, each starting with a
+ *   block header carrying the first/last timestamp of its records
+ * * A record is a u64 CLOCK_REALTIME timestamp in ns followed by the raw
+ *   (big-endian, as read from the chip) bytes of every watched register
+ *
+ * Fixed-size blocks keep the file seekable without a trailer: the reader
+ * indexes block headers and binary-searches them, and a capture cut short
+ * by a crash only loses its last, partially written block.
+ */
+
+#ifndef ZL_CAPTURE_H
+#define ZL_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "zl3073x.h"
+
+#define ZL_CAP_MAGIC       "ZLCAP\r\n\032"
+#define ZL_CAP_VERSION     1
+#define ZL_CAP_HDR_SIZE    4096
+#define ZL_CAP_BLOCK_SIZE  65536
+#define ZL_CAP_BLOCK_MAGIC 0x4B424C5A  // "ZLBK"
+#define ZL_CAP_MAX_WATCH   64
+
+/* Longest line zl_format_sample() can produce */
+#define ZL_SAMPLE_LINE_MAX (32 + ZL_CAP_MAX_WATCH * (12 + 2 * ZL_WATCH_MAX_LEN))
+
+struct zl_cap_file_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t hdr_size;
+    uint32_t block_size;
+    uint32_t rec_size;
+    uint32_t interval_us;
+    uint16_t chip_id;
+    uint16_t nwatch;
+    char devnode[64];
+    struct {
+        uint16_t reg;
+        uint8_t len;
+        uint8_t pad;
+    } watch[ZL_CAP_MAX_WATCH];
+};
+
+struct zl_cap_block_hdr {
+    uint32_t magic;
+    uint32_t nrec;
+    uint64_t first_ns;
+    uint64_t last_ns;
+};
+
+/* Capture writer: records are staged in one block buffer and written whole */
+struct zl_cap_writer {
+    int fd;
+    uint32_t rec_size;
+    uint32_t max_rec;
+    uint32_t nrec;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint8_t *blk;
+};
+
+/* One entry of the block index built when a capture is opened */
+struct zl_cap_block {
+    uint64_t first_ns;
+    uint64_t last_ns;
+    const uint8_t *recs;
+    uint32_t nrec;
+};
+
+/* Memory-mapped capture reader */
+struct zl_cap {
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    uint32_t rec_size;
+    uint32_t block_size;
+    uint32_t interval_us;
+    uint16_t chip_id;
+    char devnode[64];
+    size_t nwatch;
+    struct zl_watch watch[ZL_CAP_MAX_WATCH];
+    size_t nblocks;
+    struct zl_cap_block *idx;
+};
+
+int zl_cap_create(struct zl_cap_writer *w, const char *path,
+                  const struct zl_watch *watch, size_t nwatch,
+                  uint16_t chip_id, uint32_t interval_us);
+uint8_t *zl_cap_append(struct zl_cap_writer *w, uint64_t ts_ns);
+int zl_cap_flush(struct zl_cap_writer *w);
+int zl_cap_finish(struct zl_cap_writer *w);
+
+int zl_cap_open(struct zl_cap *c, const char *path);
+void zl_cap_close(struct zl_cap *c);
+size_t zl_cap_seek(const struct zl_cap *c, uint64_t ts_ns);
+uint64_t zl_cap_rec_ts(const uint8_t *rec);
+
+size_t zl_sample_line_max(const struct zl_watch *watch, size_t nwatch);
+size_t zl_format_sample(char *buf, size_t size, uint64_t ts_ns,
+                        const struct zl_watch *watch, size_t nwatch,
+                        const uint8_t *payload);
+int zl_parse_time(const char *s, uint64_t base_ns, uint64_t *ns);
+
+#endif /* ZL_CAPTURE_H */
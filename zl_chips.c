@@ -0,0 +1,113 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Per-variant capability database, keyed by chip ID
+ * - The table is indexed by a multiplicative hash that is perfect over
+ *   the known IDs, so a lookup is one multiply, one load and a compare.
+ *   Two IDs in one slot would be a duplicate designated initializer,
+ *   which -Wextra (-Woverride-init) reports at compile time
+ * - Per-object register blocks (DPLL channels, references, synths,
+ *   outputs) follow from the counts through the stride macros of
+ *   zl3073x.h; every variant has the same pages
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zl3073x.h"
+
+#define CHIP_HASH_BITS  5
+#define CHIP_HASH_MUL   0x06CDu
+#define CHIP_HASH(id)   ((uint16_t)((id) * CHIP_HASH_MUL) >> (16 - CHIP_HASH_BITS))
+
+#define CHIP(ID, NAME, NCHAN) \
+    [CHIP_HASH(ID)] = { .id = ID, .name = NAME, .channels = NCHAN, \
+                        .refs = ZL_NUM_REFS, .synths = ZL_NUM_SYNTHS, .outputs = ZL_NUM_OUTPUTS }
+
+static const struct zl_chip chips[1 << CHIP_HASH_BITS] = {
+    CHIP(0x0E93, "ZL30731", 1),
+    CHIP(0x1E93, "ZL30731", 1),
+    CHIP(0x2E93, "ZL30731", 1),
+    CHIP(0x0E30, "ZL30732", 2),
+    CHIP(0x0E94, "ZL30732", 2),
+    CHIP(0x1E94, "ZL30732", 2),
+    CHIP(0x1F60, "ZL30732", 2),
+    CHIP(0x2E94, "ZL30732", 2),
+    CHIP(0x3FC4, "ZL30732", 2),
+    CHIP(0x0E95, "ZL30733", 3),
+    CHIP(0x1E95, "ZL30733", 3),
+    CHIP(0x2E95, "ZL30733", 3),
+    CHIP(0x0E96, "ZL30734", 4),
+    CHIP(0x1E96, "ZL30734", 4),
+    CHIP(0x2E96, "ZL30734", 4),
+    CHIP(0x0E97, "ZL30735", 5),
+    CHIP(0x1E97, "ZL30735", 5),
+    CHIP(0x2E97, "ZL30735", 5),
+};
+
+/* Unknown IDs: assume the largest variant */
+static const struct zl_chip chip_unknown = {
+    .name = "Unknown", .channels = ZL_MAX_CHANNELS, .refs = ZL_NUM_REFS,
+    .synths = ZL_NUM_SYNTHS, .outputs = ZL_NUM_OUTPUTS,
+};
+
+/* Entry of a known chip ID, NULL if unknown */
+const struct zl_chip *
+zl_chip_lookup(uint16_t id)
+{
+    const struct zl_chip *c = &chips[CHIP_HASH(id)];
+
+    return c->name && c->id == id ? c : NULL;
+}
+
+/* Resources of the variant, the largest one if the ID is unknown */
+const struct zl_chip *
+zl_chip_caps(uint16_t id)
+{
+    const struct zl_chip *c = zl_chip_lookup(id);
+
+    return c ? c : &chip_unknown;
+}
+
+const char *
+zl_chip_name(uint16_t id)
+{
+    const struct zl_chip *c = zl_chip_lookup(id);
+
+    return c ? c->name : NULL;
+}
+
+static int
+chip_cmp(const void *a, const void *b)
+{
+    const struct zl_chip *ca = *(const struct zl_chip *const *)a;
+    const struct zl_chip *cb = *(const struct zl_chip *const *)b;
+
+    return (int)ca->id - (int)cb->id;
+}
+
+int
+cmd_chips(int fd, int argc, char **argv)
+{
+    const struct zl_chip *list[ARRAY_SIZE(chips)];
+    size_t n = 0;
+
+    (void)fd;
+    (void)argc;
+    (void)argv;
+
+    for (size_t i = 0; i < ARRAY_SIZE(chips); i++) {
+        if (chips[i].name)
+            list[n++] = &chips[i];
+    }
+    qsort(list, n, sizeof(list[0]), chip_cmp);
+
+    printf("%-7s %-8s %-8s %-4s %-6s %-7s\n",
+           "CHIP_ID", "NAME", "CHANNELS", "REFS", "SYNTHS", "OUTPUTS");
+    for (size_t i = 0; i < n; i++)
+        printf("0x%04X  %-8s %-8u %-4u %-6u %-7u\n", list[i]->id, list[i]->name,
+               list[i]->channels, list[i]->refs, list[i]->synths, list[i]->outputs);
+
+    return EXIT_SUCCESS;
+}
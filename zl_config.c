@@ -0,0 +1,337 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Chip configuration export/import
+ * - Export: every mailbox object (pipelined readout) and the directly
+ *   addressed configuration registers, one hex line each:
+ *       chip 0x0E95
+ *       ref0 C3CAD1...
+ *       reg 0x0284 23
+ * - Import: the live configuration is read back and compared; only the
+ *   mailbox objects that differ are stored, and only the changed direct
+ *   registers are written. Direct registers are one byte per DPLL channel
+ *   at a stride; the bytes between them belong to other registers and
+ *   are neither saved nor written
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zl3073x.h"
+
+/* Directly addressed configuration, one byte per DPLL channel at stride */
+static const struct config_block {
+    uint16_t reg;
+    uint8_t stride;
+} config_blocks[] = {
+    { ZL_REG_DPLL_MODE_REFSEL(0), 4 },  /* mode and forced reference */
+};
+
+#define CONFIG_BLOCK_MAX  ZL_DPLL_MODE_SPAN(ZL_MAX_CHANNELS)
+
+struct config_file {
+    uint16_t chip_id;
+    bool has_chip;
+    uint16_t present[ZL_MB_NTYPES];
+    struct zl_mb_config mb;
+    size_t nregs;
+    struct {
+        uint16_t reg;
+        uint8_t chan, val;
+    } regs[ARRAY_SIZE(config_blocks) * ZL_MAX_CHANNELS];
+};
+
+static size_t
+block_len(const struct config_block *b, unsigned int nchan)
+{
+    return (size_t)b->stride * (nchan - 1) + 1;
+}
+
+/* Channel of reg in block b, -1 if reg is not one of its bytes */
+static int
+block_chan(const struct config_block *b, uint16_t reg)
+{
+    unsigned int k = (unsigned int)(reg - b->reg);
+
+    if (reg < b->reg || k % b->stride || k / b->stride >= ZL_MAX_CHANNELS)
+        return -1;
+    return (int)(k / b->stride);
+}
+
+static void
+put_hex(FILE *f, const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        fprintf(f, "%02X", p[i]);
+    fputc('\n', f);
+}
+
+static int
+get_hex(const char *s, uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        unsigned int v;
+
+        if (sscanf(s + 2 * i, "%2x", &v) != 1)
+            return -EINVAL;
+        p[i] = (uint8_t)v;
+    }
+    return s[2 * len] == '\0' ? 0 : -EINVAL;
+}
+
+static uint16_t
+read_chip_id(int fd)
+{
+    uint8_t id[2];
+
+    if (zl_read_reg(fd, ZL_REG_ID, id, sizeof(id)) < 0)
+        errx(EXIT_FAILURE, "read ZL_REG_ID failed");
+    return (uint16_t)((id[0] << 8) | id[1]);
+}
+
+static int
+config_export(int fd, const char *path)
+{
+    static struct zl_mb_config cfg;
+    uint16_t chip_id = read_chip_id(fd);
+    unsigned int nchan = zl_chip_caps(chip_id)->channels;
+    FILE *f = path ? fopen(path, "w") : stdout;
+    int rc;
+
+    if (!f)
+        err(EXIT_FAILURE, "%s", path);
+
+    zl_mb_counts(&cfg, chip_id);
+    rc = zl_mb_read_all(fd, &cfg, true);
+    if (rc < 0)
+        errx(EXIT_FAILURE, "mailbox readout failed: %s", strerror(-rc));
+
+    fprintf(f, "# zl30733_id configuration of %s\n", devnode);
+    fprintf(f, "chip 0x%04X\n", chip_id);
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        for (unsigned int i = 0; i < cfg.count[t]; i++) {
+            fprintf(f, "%s%u ", zl_mb_name(t), i);
+            put_hex(f, cfg.data[t][i], ZL_MB_DATA_LEN);
+        }
+    }
+    for (size_t b = 0; b < ARRAY_SIZE(config_blocks); b++) {
+        uint8_t data[CONFIG_BLOCK_MAX];
+        size_t len = block_len(&config_blocks[b], nchan);
+
+        if (zl_read_reg(fd, config_blocks[b].reg, data, len) < 0)
+            errx(EXIT_FAILURE, "read register 0x%04X failed", config_blocks[b].reg);
+        for (unsigned int c = 0; c < nchan; c++) {
+            fprintf(f, "reg 0x%04X ", config_blocks[b].reg + c * config_blocks[b].stride);
+            put_hex(f, data + c * config_blocks[b].stride, 1);
+        }
+    }
+
+    if (f != stdout && fclose(f))
+        err(EXIT_FAILURE, "%s", path);
+    return EXIT_SUCCESS;
+}
+
+static int
+config_parse_line(struct config_file *c, char *line)
+{
+    char *key = strtok(line, " \t\r\n");
+    char *val = strtok(NULL, " \t\r\n");
+
+    if (!key || key[0] == '#')
+        return 0;
+    if (!val)
+        return -EINVAL;
+
+    if (!strcmp(key, "chip")) {
+        c->chip_id = (uint16_t)strtoul(val, NULL, 0);
+        c->has_chip = true;
+        return 0;
+    }
+
+    if (!strcmp(key, "reg")) {
+        char *hex = strtok(NULL, " \t\r\n");
+        uint16_t reg = (uint16_t)strtoul(val, NULL, 0);
+        int chan = -1;
+
+        /* only the channel bytes of the known blocks are restored */
+        for (size_t k = 0; k < ARRAY_SIZE(config_blocks) && chan < 0; k++)
+            chan = block_chan(&config_blocks[k], reg);
+        if (chan < 0 || !hex || strlen(hex) != 2 || c->nregs == ARRAY_SIZE(c->regs) ||
+            get_hex(hex, &c->regs[c->nregs].val, 1) < 0)
+            return -EINVAL;
+        c->regs[c->nregs].reg = reg;
+        c->regs[c->nregs].chan = (uint8_t)chan;
+        c->nregs++;
+        return 0;
+    }
+
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        size_t nl = strlen(zl_mb_name(t));
+        char *end;
+
+        if (strncmp(key, zl_mb_name(t), nl) || key[nl] < '0' || key[nl] > '9')
+            continue;
+
+        unsigned long idx = strtoul(key + nl, &end, 10);
+
+        if (*end || idx >= ZL_MB_MAX_OBJS || get_hex(val, c->mb.data[t][idx], ZL_MB_DATA_LEN) < 0)
+            return -EINVAL;
+        c->present[t] |= (uint16_t)(1u << idx);
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+static int
+config_import(int fd, const char *path, bool dry_run, bool force, bool verbose)
+{
+    static struct config_file file;
+    static struct zl_mb_config live;
+    uint16_t sel[ZL_MB_NTYPES] = {0};
+    unsigned int nobj = 0, ndiff = 0, nregs = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    unsigned long lineno = 0;
+    FILE *f = fopen(path, "r");
+    int rc;
+
+    if (!f)
+        err(EXIT_FAILURE, "%s", path);
+    while (getline(&line, &cap, f) > 0) {
+        lineno++;
+        if (config_parse_line(&file, line) < 0)
+            errx(EXIT_FAILURE, "%s:%lu: invalid line", path, lineno);
+    }
+    free(line);
+    fclose(f);
+
+    uint16_t chip_id = read_chip_id(fd);
+
+    if (file.has_chip && file.chip_id != chip_id && !force)
+        errx(EXIT_FAILURE, "%s is for chip 0x%04X, device is 0x%04X (-f to override)",
+             path, file.chip_id, chip_id);
+
+    uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+    unsigned int nchan = zl_chip_caps(chip_id)->channels;
+
+    zl_mb_counts(&live, chip_id);
+    rc = zl_mb_read_all(fd, &live, true);
+    if (rc < 0)
+        errx(EXIT_FAILURE, "mailbox readout failed: %s", strerror(-rc));
+
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        file.mb.count[t] = live.count[t];
+        for (unsigned int i = 0; i < live.count[t]; i++) {
+            if (!(file.present[t] & (1u << i)))
+                continue;
+            nobj++;
+
+            unsigned int nb = 0;
+
+            for (size_t k = 0; k < ZL_MB_DATA_LEN; k++)
+                nb += file.mb.data[t][i][k] != live.data[t][i][k];
+            if (!nb)
+                continue;
+            sel[t] |= (uint16_t)(1u << i);
+            ndiff++;
+            if (verbose || dry_run)
+                printf("%s%u: %u bytes differ\n", zl_mb_name(t), i, nb);
+        }
+    }
+
+    if (!dry_run && ndiff) {
+        rc = zl_mb_write(fd, &file.mb, sel);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "mailbox store failed: %s", strerror(-rc));
+    }
+
+    /* direct registers: write the changed channel bytes only */
+    for (size_t r = 0; r < file.nregs; r++) {
+        uint16_t reg = file.regs[r].reg;
+        uint8_t cur;
+
+        /* channels the device lacks: the byte is some other register */
+        if (file.regs[r].chan >= nchan) {
+            warnx("reg 0x%04X: no DPLL channel %u on this device, skipped", reg,
+                  file.regs[r].chan);
+            continue;
+        }
+        if (zl_read_reg(fd, reg, &cur, 1) < 0)
+            errx(EXIT_FAILURE, "read register 0x%04X failed", reg);
+        if (cur == file.regs[r].val)
+            continue;
+        if (verbose || dry_run)
+            printf("reg 0x%04X: 0x%02X -> 0x%02X\n", reg, cur, file.regs[r].val);
+        if (!dry_run && zl_write_reg(fd, reg, &file.regs[r].val, 1) < 0)
+            errx(EXIT_FAILURE, "write register 0x%04X failed", reg);
+        nregs++;
+    }
+
+    uint64_t t1 = zl_now_ns(CLOCK_MONOTONIC);
+
+    fprintf(stderr, "config: %u of %u mailbox objects and %u registers %s in %llu us\n",
+            ndiff, nobj, nregs, dry_run ? "differ" : "written",
+            (unsigned long long)((t1 - t0) / 1000));
+
+    return EXIT_SUCCESS;
+}
+
+static void
+config_usage(void)
+{
+    fprintf(stderr,
+        "Usage: config [-o FILE]\n"
+        "       config -i FILE [-n] [-f] [-v]\n"
+        "  -o  export the configuration to FILE (default: stdout)\n"
+        "  -i  import FILE, writing only what differs from the device\n"
+        "  -n  dry run: only list the differences\n"
+        "  -f  import even if the chip ID does not match\n"
+        "  -v  list every object written\n"
+    );
+}
+
+int
+cmd_config(int fd, int argc, char **argv)
+{
+    const char *out = NULL, *in = NULL;
+    bool dry_run = false, force = false, verbose = false;
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "o:i:nfvh")) != -1) {
+        switch (opt) {
+        case 'o':
+            out = optarg;
+            break;
+        case 'i':
+            in = optarg;
+            break;
+        case 'n':
+            dry_run = true;
+            break;
+        case 'f':
+            force = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            config_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || (in && out)) {
+        config_usage();
+        return EXIT_FAILURE;
+    }
+
+    return in ? config_import(fd, in, dry_run, force, verbose) : config_export(fd, out);
+}
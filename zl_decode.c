@@ -0,0 +1,296 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Offline capture decoder
+ * - The selected block range is cut into chunks of whole blocks
+ * - A pool of worker threads formats chunks into private buffers
+ * - The calling thread writes finished chunks strictly in block order,
+ *   i.e. in capture (timestamp) order, at most 'window' chunks ahead
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+#include "zl_capture.h"
+
+#define DECODE_CHUNK_BLOCKS 4
+
+struct decode_slot {
+    char *buf;
+    size_t len;
+    uint64_t nsamples;
+    bool done;
+};
+
+struct decode_job {
+    const struct zl_cap *cap;
+    size_t first;
+    size_t nchunks;
+    size_t last;
+    uint64_t from, to;
+    size_t bufsize;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t next_chunk;      /* next chunk handed to a worker */
+    size_t next_out;        /* next chunk to be written */
+    size_t window;
+    struct decode_slot *slots;
+};
+
+static void
+decode_chunk(const struct decode_job *job, size_t chunk, struct decode_slot *slot)
+{
+    const struct zl_cap *cap = job->cap;
+    size_t b0 = job->first + chunk * DECODE_CHUNK_BLOCKS;
+    size_t b1 = b0 + DECODE_CHUNK_BLOCKS;
+    char *out = slot->buf;
+    size_t room = job->bufsize;
+
+    if (b1 > job->last)
+        b1 = job->last;
+
+    slot->nsamples = 0;
+    for (size_t b = b0; b < b1; b++) {
+        const uint8_t *rec = cap->idx[b].recs;
+        for (uint32_t r = 0; r < cap->idx[b].nrec; r++, rec += cap->rec_size) {
+            uint64_t ts = zl_cap_rec_ts(rec);
+            if (ts < job->from || ts > job->to)
+                continue;
+            size_t n = zl_format_sample(out, room, ts, cap->watch, cap->nwatch,
+                                        rec + sizeof(uint64_t));
+            out += n;
+            room -= n;
+            slot->nsamples++;
+        }
+    }
+    slot->len = (size_t)(out - slot->buf);
+}
+
+static void *
+decode_worker(void *arg)
+{
+    struct decode_job *job = arg;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        while (job->next_chunk < job->nchunks &&
+               job->next_chunk >= job->next_out + job->window)
+            pthread_cond_wait(&job->cond, &job->lock);
+        if (job->next_chunk >= job->nchunks)
+            break;
+
+        size_t chunk = job->next_chunk++;
+        struct decode_slot *slot = &job->slots[chunk % job->window];
+
+        pthread_mutex_unlock(&job->lock);
+        decode_chunk(job, chunk, slot);
+        pthread_mutex_lock(&job->lock);
+
+        slot->done = true;
+        pthread_cond_broadcast(&job->cond);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+/* Decode blocks [first, last) to out with nthreads workers; returns samples */
+static uint64_t
+decode_range(const struct zl_cap *cap, size_t first, size_t last,
+             uint64_t from, uint64_t to, unsigned int nthreads, FILE *out)
+{
+    struct decode_job job = {
+        .cap = cap,
+        .first = first,
+        .last = last,
+        .nchunks = (last - first + DECODE_CHUNK_BLOCKS - 1) / DECODE_CHUNK_BLOCKS,
+        .from = from,
+        .to = to,
+        .window = nthreads > 1 ? 2 * (size_t)nthreads : 1,
+    };
+    uint32_t max_rec = (cap->block_size - sizeof(struct zl_cap_block_hdr)) / cap->rec_size;
+    pthread_t *tids = NULL;
+    unsigned int started = 0;
+    uint64_t nsamples = 0;
+
+    job.bufsize = (size_t)DECODE_CHUNK_BLOCKS * max_rec *
+                  zl_sample_line_max(cap->watch, cap->nwatch) + 1;
+    job.slots = calloc(job.window, sizeof(*job.slots));
+    if (!job.slots)
+        err(EXIT_FAILURE, "calloc");
+    for (size_t i = 0; i < job.window; i++) {
+        job.slots[i].buf = malloc(job.bufsize);
+        if (!job.slots[i].buf)
+            err(EXIT_FAILURE, "malloc %zu", job.bufsize);
+    }
+
+    if (nthreads <= 1) {
+        for (size_t c = 0; c < job.nchunks; c++) {
+            decode_chunk(&job, c, &job.slots[0]);
+            fwrite(job.slots[0].buf, 1, job.slots[0].len, out);
+            nsamples += job.slots[0].nsamples;
+        }
+        goto fini;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    tids = calloc(nthreads, sizeof(*tids));
+    if (!tids)
+        err(EXIT_FAILURE, "calloc");
+    for (; started < nthreads; started++) {
+        int rc = pthread_create(&tids[started], NULL, decode_worker, &job);
+        if (rc) {
+            warnx("pthread_create: %s, continuing with %u threads",
+                  strerror(rc), started);
+            break;
+        }
+    }
+    if (!started)
+        errx(EXIT_FAILURE, "no decoder thread could be started");
+
+    for (size_t c = 0; c < job.nchunks; c++) {
+        struct decode_slot *slot = &job.slots[c % job.window];
+
+        pthread_mutex_lock(&job.lock);
+        while (!slot->done)
+            pthread_cond_wait(&job.cond, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+
+        fwrite(slot->buf, 1, slot->len, out);
+        nsamples += slot->nsamples;
+
+        pthread_mutex_lock(&job.lock);
+        slot->done = false;
+        job.next_out++;
+        pthread_cond_broadcast(&job.cond);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    for (unsigned int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.lock);
+
+fini:
+    for (size_t i = 0; i < job.window; i++)
+        free(job.slots[i].buf);
+    free(job.slots);
+    free(tids);
+
+    return nsamples;
+}
+
+static void
+read_usage(void)
+{
+    fprintf(stderr,
+        "Usage: read [-f from] [-t to] [-j threads] [-v] capture\n"
+        "  -f  first timestamp: epoch seconds, UTC YYYY-MM-DDTHH:MM:SS[.frac]\n"
+        "  -t  last timestamp, same forms or +SECONDS after -f\n"
+        "  -j  decoder threads, 0 = one per online CPU (default 1)\n"
+        "  -v  report decode throughput on stderr\n"
+    );
+}
+
+int
+cmd_read(int fd, int argc, char **argv)
+{
+    const char *from_s = NULL, *to_s = NULL;
+    uint64_t from = 0, to = UINT64_MAX;
+    unsigned int nthreads = 1;
+    bool verbose = false;
+    struct zl_cap cap;
+    int opt, rc;
+
+    (void)fd;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "f:t:j:vh")) != -1) {
+        switch (opt) {
+        case 'f':
+            from_s = optarg;
+            break;
+        case 't':
+            to_s = optarg;
+            break;
+        case 'j':
+            nthreads = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            read_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        read_usage();
+        return EXIT_FAILURE;
+    }
+    if (nthreads == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (unsigned int)ncpu : 1;
+    }
+
+    if (from_s && zl_parse_time(from_s, 0, &from) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", from_s);
+    if (to_s && zl_parse_time(to_s, from, &to) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", to_s);
+
+    rc = zl_cap_open(&cap, argv[optind]);
+    if (rc < 0)
+        errx(EXIT_FAILURE, "open capture %s: %s", argv[optind], strerror(-rc));
+
+    size_t first = zl_cap_seek(&cap, from);
+    size_t last = first;
+    while (last < cap.nblocks && cap.idx[last].first_ns <= to)
+        last++;
+
+    if (debug > 0)
+        fprintf(stderr, "capture %s: %zu blocks, decoding %zu..%zu on %u threads\n",
+                argv[optind], cap.nblocks, first, last, nthreads);
+
+    size_t bytes = (last - first) * cap.block_size;
+    if (bytes)
+        madvise((void *)(cap.idx[first].recs - sizeof(struct zl_cap_block_hdr)),
+                bytes, MADV_WILLNEED);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    uint64_t nsamples = decode_range(&cap, first, last, from, to, nthreads, stdout);
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (verbose) {
+        double s = (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (s <= 0)
+            s = 1e-9;
+        fprintf(stderr,
+                "decoded %zu blocks (%.1f MB), %llu samples in %.3f s on %u threads: "
+                "%.1f MB/s, %.0f samples/s\n",
+                last - first, bytes / 1e6, (unsigned long long)nsamples, s, nthreads,
+                bytes / 1e6 / s, nsamples / s);
+    }
+
+    zl_cap_close(&cap);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * DPLL channel status sweep
+ * - Monitor status and reference selection status are contiguous per
+ *   channel on page 2, mode/refsel control is strided by 4 on page 5:
+ *   three bursts, batched into one SPI message through a plan
+ * - Only the channels of the detected variant are read
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zl3073x.h"
+
+static const char *const mon_state[] = {
+    [ZL_DPLL_MON_STATE_ACQUIRING] = "acquiring",
+    [ZL_DPLL_MON_STATE_LOCK] = "locked",
+    [ZL_DPLL_MON_STATE_HOLDOVER] = "holdover",
+    [3] = "?",
+};
+
+static const char *const refsel_state[8] = {
+    "freerun", "holdover", "fastlock", "acquiring", "lock",
+};
+
+static const char *const mode_name[8] = {
+    [ZL_DPLL_MODE_FREERUN] = "freerun",
+    [ZL_DPLL_MODE_HOLDOVER] = "holdover",
+    [ZL_DPLL_MODE_REFLOCK] = "reflock",
+    [ZL_DPLL_MODE_AUTO] = "auto",
+    [ZL_DPLL_MODE_NCO] = "nco",
+};
+
+#define NAME_OR(tbl, i) ((tbl)[i] ? (tbl)[i] : "?")
+
+/* The reference field is only meaningful once the DPLL tracks one */
+static const char *
+selected_ref(uint8_t refsel)
+{
+    unsigned int ref = refsel & ZL_DPLL_REFSEL_REF_MASK;
+
+    if (((refsel >> ZL_DPLL_REFSEL_STATE_SHIFT) & 7) < 2 || ref >= ZL_NUM_REFS)
+        return "-";
+    return zl_ref_name(ref);
+}
+
+/* "locked ho-ready sel=REF0P/lock mode=auto" */
+size_t
+zl_dpll_format(char *buf, size_t size, uint8_t mon, uint8_t refsel, uint8_t ctrl)
+{
+    int n;
+
+    n = snprintf(buf, size, "%s%s sel=%s/%s mode=%s",
+                 mon_state[mon & ZL_DPLL_MON_STATE_MASK],
+                 (mon & ZL_DPLL_MON_HO_READY) ? " ho-ready" : "",
+                 selected_ref(refsel),
+                 NAME_OR(refsel_state, (refsel >> ZL_DPLL_REFSEL_STATE_SHIFT) & 7),
+                 NAME_OR(mode_name, ctrl & ZL_DPLL_MODE_MASK));
+    if (n < 0)
+        return 0;
+    return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+static void
+dplls_usage(void)
+{
+    fprintf(stderr,
+        "Usage: dplls [-c channels] [-v]\n"
+        "  -c  number of DPLL channels (default: from the chip ID)\n"
+        "  -v  print the transaction time\n"
+    );
+}
+
+int
+cmd_dplls(int fd, int argc, char **argv)
+{
+    static struct zl_plan plan;
+    unsigned int nchan = 0;
+    bool verbose = false;
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "c:vh")) != -1) {
+        switch (opt) {
+        case 'c':
+            nchan = (unsigned int)strtoul(optarg, NULL, 0);
+            if (nchan == 0 || nchan > ZL_MAX_CHANNELS)
+                errx(EXIT_FAILURE, "invalid channel count %s", optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            dplls_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        dplls_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!nchan) {
+        uint8_t id[2];
+
+        if (zl_read_reg(fd, ZL_REG_ID, id, sizeof(id)) < 0)
+            errx(EXIT_FAILURE, "read ZL_REG_ID failed");
+        nchan = zl_chip_caps((uint16_t)((id[0] << 8) | id[1]))->channels;
+    }
+
+    zl_plan_init(&plan);
+    int mon = zl_plan_read(&plan, ZL_REG_DPLL_MON_STATUS(0), nchan);
+    int refsel = zl_plan_read(&plan, ZL_REG_DPLL_REFSEL_STATUS(0), nchan);
+    int ctrl = zl_plan_read(&plan, ZL_REG_DPLL_MODE_REFSEL(0), ZL_DPLL_MODE_SPAN(nchan));
+
+    if (mon < 0 || refsel < 0 || ctrl < 0)
+        errx(EXIT_FAILURE, "cannot plan the DPLL status sweep");
+
+    uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+    if (zl_plan_submit(fd, &plan) < 0)
+        errx(EXIT_FAILURE, "DPLL status transfer failed");
+    uint64_t t1 = zl_now_ns(CLOCK_MONOTONIC);
+
+    if (out_format == ZL_FMT_TEXT)
+        printf("%-5s %-4s %-10s %-8s %-6s %-9s %-8s\n",
+               "DPLL", "MON", "STATE", "HO-READY", "REF", "REFSEL", "MODE");
+    for (unsigned int c = 0; c < nchan; c++) {
+        uint8_t m = plan.rx[mon + c], r = plan.rx[refsel + c], md = plan.rx[ctrl + 4 * c];
+
+        if (out_format != ZL_FMT_TEXT) {
+            static struct zl_rec rec;
+
+            zl_rec_begin(&rec);
+            zl_rec_u64(&rec, "dpll", c);
+            zl_rec_hex(&rec, "mon", m, 1);
+            zl_rec_str(&rec, "state", mon_state[m & ZL_DPLL_MON_STATE_MASK]);
+            zl_rec_bool(&rec, "ho_ready", m & ZL_DPLL_MON_HO_READY);
+            zl_rec_str(&rec, "ref", selected_ref(r));
+            zl_rec_str(&rec, "refsel", NAME_OR(refsel_state, (r >> ZL_DPLL_REFSEL_STATE_SHIFT) & 7));
+            zl_rec_str(&rec, "mode", NAME_OR(mode_name, md & ZL_DPLL_MODE_MASK));
+            if (zl_rec_end(&rec) < 0)
+                errx(EXIT_FAILURE, "write DPLL record failed");
+            continue;
+        }
+        printf("%-5u 0x%02X %-10s %-8s %-6s %-9s %-8s\n", c, m,
+               mon_state[m & ZL_DPLL_MON_STATE_MASK],
+               (m & ZL_DPLL_MON_HO_READY) ? "yes" : "no",
+               selected_ref(r),
+               NAME_OR(refsel_state, (r >> ZL_DPLL_REFSEL_STATE_SHIFT) & 7),
+               NAME_OR(mode_name, md & ZL_DPLL_MODE_MASK));
+    }
+
+    if (verbose)
+        fprintf(stderr, "dplls: %u channels in %u transfers, %llu us\n", nchan,
+                plan.nxfer, (unsigned long long)((t1 - t0) / 1000));
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Interrupt line events through the GPIO character device (uAPI v2)
+ * - "/dev/gpiochipN:LINE" (or "gpiochipN:LINE") is requested as an input
+ *   with edge detection on assertion and REALTIME event timestamps, so
+ *   events carry the kernel's interrupt time
+ * - The line is active low unless asked otherwise (open-drain IRQ pin)
+ * - Waiting is an epoll on the line request fd with a timeout, which the
+ *   caller uses as a slow watchdog poll
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+
+#include "zl3073x.h"
+
+int
+zl_gpio_open(struct zl_gpio *g, const char *spec, bool active_high)
+{
+    char chip[64];
+    const char *colon = strrchr(spec, ':');
+    char *end;
+
+    g->line_fd = g->epoll_fd = -1;
+    if (!colon || colon == spec)
+        return -EINVAL;
+
+    unsigned long line = strtoul(colon + 1, &end, 0);
+
+    if (*end || end == colon + 1)
+        return -EINVAL;
+    snprintf(chip, sizeof(chip), "%s%.*s", spec[0] == '/' ? "" : "/dev/",
+             (int)(colon - spec), spec);
+
+    int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+
+    if (chip_fd < 0)
+        return -errno;
+
+    struct gpio_v2_line_request req = {
+        .offsets = { (uint32_t)line },
+        .num_lines = 1,
+        .config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+                        GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME |
+                        (active_high ? 0 : GPIO_V2_LINE_FLAG_ACTIVE_LOW),
+    };
+    int rc = 0;
+
+    snprintf(req.consumer, sizeof(req.consumer), "zl30733_id");
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+        rc = -errno;
+    close(chip_fd);
+    if (rc < 0)
+        return rc;
+    g->line_fd = req.fd;
+
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    g->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g->epoll_fd < 0 || epoll_ctl(g->epoll_fd, EPOLL_CTL_ADD, g->line_fd, &ev) < 0) {
+        rc = -errno;
+        zl_gpio_close(g);
+        return rc;
+    }
+
+    return 0;
+}
+
+void
+zl_gpio_close(struct zl_gpio *g)
+{
+    if (g->epoll_fd >= 0)
+        close(g->epoll_fd);
+    if (g->line_fd >= 0)
+        close(g->line_fd);
+    g->line_fd = g->epoll_fd = -1;
+}
+
+/*
+ * Wait up to timeout_ms for the line to assert; returns the number of
+ * edges consumed (the first one's time in *ts), 0 on timeout
+ */
+int
+zl_gpio_wait(struct zl_gpio *g, int timeout_ms, uint64_t *ts)
+{
+    struct gpio_v2_line_event events[16];
+    struct epoll_event ev;
+    int n = epoll_wait(g->epoll_fd, &ev, 1, timeout_ms);
+
+    if (n <= 0)
+        return n < 0 ? -errno : 0;
+
+    ssize_t len = read(g->line_fd, events, sizeof(events));
+
+    if (len < (ssize_t)sizeof(events[0]))
+        return len < 0 ? -errno : -EIO;
+
+    *ts = events[0].timestamp_ns;
+    return (int)(len / (ssize_t)sizeof(events[0]));
+}
+
+/* 1 while the line is asserted, 0 if not, -errno on error */
+int
+zl_gpio_active(struct zl_gpio *g)
+{
+    struct gpio_v2_line_values v = { .mask = 1 };
+
+    if (ioctl(g->line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0)
+        return -errno;
+    return (int)(v.bits & 1);
+}
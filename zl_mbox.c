@@ -0,0 +1,329 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Mailbox engine for the reference, DPLL, synthesizer and output
+ * configuration (pages 10, 12, 13, 14)
+ *
+ * Each mailbox type is a lane with at most one operation in flight. Every
+ * round is one SPI message carrying, for all lanes at once, either the
+ * trigger of the next object (mask and semaphore in one 3-byte write) or
+ * a poll of the pending one (semaphore and data in one burst: when the
+ * semaphore reads clear, the data that follows it is valid). Readout of
+ * every type therefore takes as long as the slowest lane rather than the
+ * sum of all of them. Rounds without progress back off exponentially.
+ *
+ * Writes use the same lanes: the trigger message carries the data burst
+ * followed by the mask and semaphore, and polls read the semaphore only.
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zl3073x.h"
+
+#define MB_BACKOFF_MIN_NS   10000
+#define MB_BACKOFF_MAX_NS   1000000
+#define MB_TIMEOUT_NS       1000000000ull
+
+static const struct {
+    const char *name;
+    uint8_t page;
+} mb_types[ZL_MB_NTYPES] = {
+    [ZL_MB_REF]    = { "ref",    10 },
+    [ZL_MB_DPLL]   = { "dpll",   12 },
+    [ZL_MB_SYNTH]  = { "synth",  13 },
+    [ZL_MB_OUTPUT] = { "output", 14 },
+};
+
+const char *
+zl_mb_name(unsigned int type)
+{
+    return type < ZL_MB_NTYPES ? mb_types[type].name : "?";
+}
+
+uint8_t
+zl_mb_page(unsigned int type)
+{
+    return mb_types[type].page;
+}
+
+/* Every object of the variant identified by chip_id */
+void
+zl_mb_counts(struct zl_mb_config *cfg, uint16_t chip_id)
+{
+    const struct zl_chip *c = zl_chip_caps(chip_id);
+
+    cfg->count[ZL_MB_REF] = c->refs;
+    cfg->count[ZL_MB_DPLL] = c->channels;
+    cfg->count[ZL_MB_SYNTH] = c->synths;
+    cfg->count[ZL_MB_OUTPUT] = c->outputs;
+}
+
+static void
+mb_trigger_bytes(uint8_t *b, unsigned int idx, uint8_t op)
+{
+    uint16_t mask = (uint16_t)(1u << idx);
+
+    b[0] = (uint8_t)(mask >> 8);
+    b[1] = (uint8_t)mask;
+    b[2] = op;
+}
+
+/* One object at a time, one register access per message */
+static int
+mb_read_serial(int fd, struct zl_mb_config *cfg)
+{
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        uint8_t page = mb_types[t].page;
+
+        for (unsigned int i = 0; i < cfg->count[t]; i++) {
+            uint16_t mask = htobe16((uint16_t)(1u << i));
+            uint8_t op = ZL_MB_SEM_RD, sem;
+            uint64_t start = zl_now_ns(CLOCK_MONOTONIC);
+
+            if (zl_write_reg(fd, ZL_REG(page, ZL_MB_MASK), (uint8_t *)&mask, 2) < 0 ||
+                zl_write_reg(fd, ZL_REG(page, ZL_MB_SEM), &op, 1) < 0)
+                return -EIO;
+            cfg->nmsg += 4;     /* each access is a page select and a transfer */
+            do {
+                if (zl_now_ns(CLOCK_MONOTONIC) - start > MB_TIMEOUT_NS)
+                    return -ETIMEDOUT;
+                if (zl_read_reg(fd, ZL_REG(page, ZL_MB_SEM), &sem, 1) < 0)
+                    return -EIO;
+                cfg->nmsg += 2;
+                cfg->npoll++;
+            } while (sem & (ZL_MB_SEM_RD | ZL_MB_SEM_WR));
+
+            if (zl_read_reg(fd, ZL_REG(page, ZL_MB_DATA), cfg->data[t][i], ZL_MB_DATA_LEN) < 0)
+                return -EIO;
+            cfg->nmsg += 2;
+        }
+    }
+    return 0;
+}
+
+struct mb_lane {
+    unsigned int type;
+    uint16_t todo;          /* objects left, one bit each */
+    unsigned int cur;       /* object in flight */
+    bool pending;           /* an operation is in flight */
+    int rx;                 /* poll burst offset in the round plan */
+    uint64_t start_ns;
+};
+
+/* Run op (ZL_MB_SEM_RD or ZL_MB_SEM_WR) on the objects in sel[type] */
+static int
+mb_pipeline(int fd, struct zl_mb_config *cfg, const uint16_t *sel, uint8_t op)
+{
+    static struct zl_plan plan;
+    struct mb_lane lanes[ZL_MB_NTYPES];
+    unsigned int nlanes = 0;
+    uint64_t backoff = 0;
+    size_t poll_len = op == ZL_MB_SEM_RD ? 1 + ZL_MB_DATA_LEN : 1;
+
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        uint16_t todo = sel[t] & (uint16_t)((1u << cfg->count[t]) - 1);
+
+        if (todo)
+            lanes[nlanes++] = (struct mb_lane){ .type = t, .todo = todo, .rx = -1 };
+    }
+
+    for (;;) {
+        unsigned int active = 0;
+
+        zl_plan_init(&plan);
+        for (unsigned int l = 0; l < nlanes; l++) {
+            struct mb_lane *ln = &lanes[l];
+            uint8_t page = mb_types[ln->type].page;
+
+            ln->rx = -1;
+            if (ln->pending) {
+                ln->rx = zl_plan_read(&plan, ZL_REG(page, ZL_MB_SEM), poll_len);
+                cfg->npoll++;
+            } else if (ln->todo) {
+                uint8_t b[3];
+
+                ln->cur = (unsigned int)__builtin_ctz(ln->todo);
+                ln->todo &= (uint16_t)(ln->todo - 1);
+                mb_trigger_bytes(b, ln->cur, op);
+                if (op == ZL_MB_SEM_WR &&
+                    zl_plan_write(&plan, ZL_REG(page, ZL_MB_DATA),
+                                  cfg->data[ln->type][ln->cur], ZL_MB_DATA_LEN) < 0)
+                    return -ENOSPC;
+                if (zl_plan_write(&plan, ZL_REG(page, ZL_MB_MASK), b, sizeof(b)) < 0)
+                    return -ENOSPC;
+                ln->pending = true;
+                ln->start_ns = zl_now_ns(CLOCK_MONOTONIC);
+            } else {
+                continue;
+            }
+            active++;
+        }
+        if (!active)
+            return 0;
+
+        if (zl_plan_submit(fd, &plan) < 0)
+            return -EIO;
+        cfg->nmsg++;
+
+        bool progress = false, triggered = false;
+        uint64_t now = zl_now_ns(CLOCK_MONOTONIC);
+
+        for (unsigned int l = 0; l < nlanes; l++) {
+            struct mb_lane *ln = &lanes[l];
+
+            if (!ln->pending)
+                continue;
+            if (ln->rx < 0) {
+                triggered = true;
+                continue;
+            }
+            if (plan.rx[ln->rx] & (ZL_MB_SEM_RD | ZL_MB_SEM_WR)) {
+                if (now - ln->start_ns > MB_TIMEOUT_NS)
+                    return -ETIMEDOUT;
+                continue;
+            }
+            if (op == ZL_MB_SEM_RD)
+                memcpy(cfg->data[ln->type][ln->cur], plan.rx + ln->rx + 1, ZL_MB_DATA_LEN);
+            ln->pending = false;
+            progress = true;
+        }
+
+        /* back off only when a whole round polled busy semaphores */
+        if (progress || triggered) {
+            backoff = 0;
+            continue;
+        }
+        backoff = backoff ? backoff * 2 : MB_BACKOFF_MIN_NS;
+        if (backoff > MB_BACKOFF_MAX_NS)
+            backoff = MB_BACKOFF_MAX_NS;
+
+        struct timespec ts = { 0, (long)backoff };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* Read the configuration of cfg->count[type] objects of every type */
+int
+zl_mb_read_all(int fd, struct zl_mb_config *cfg, bool pipelined)
+{
+    uint16_t all[ZL_MB_NTYPES];
+
+    cfg->nmsg = cfg->npoll = 0;
+    if (!pipelined)
+        return mb_read_serial(fd, cfg);
+
+    memset(all, 0xFF, sizeof(all));
+    return mb_pipeline(fd, cfg, all, ZL_MB_SEM_RD);
+}
+
+/* Store cfg->data of the objects selected in sel[type] */
+int
+zl_mb_write(int fd, struct zl_mb_config *cfg, const uint16_t *sel)
+{
+    cfg->nmsg = cfg->npoll = 0;
+    return mb_pipeline(fd, cfg, sel, ZL_MB_SEM_WR);
+}
+
+static void
+mbox_usage(void)
+{
+    fprintf(stderr,
+        "Usage: mbox [-t type]... [-S] [-v]\n"
+        "  -t  ref, dpll, synth or output (default: all)\n"
+        "  -S  serial access, one object and register at a time\n"
+        "  -v  print the readout time and message count\n"
+        "Dumps the mailbox configuration of every object\n"
+    );
+}
+
+int
+cmd_mbox(int fd, int argc, char **argv)
+{
+    static struct zl_mb_config cfg;
+    unsigned int types = 0;
+    bool serial = false, verbose = false;
+    uint8_t id[2];
+    int opt, rc;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "t:Svh")) != -1) {
+        switch (opt) {
+        case 't': {
+            unsigned int t;
+
+            for (t = 0; t < ZL_MB_NTYPES; t++) {
+                if (!strcmp(optarg, mb_types[t].name))
+                    break;
+            }
+            if (t == ZL_MB_NTYPES)
+                errx(EXIT_FAILURE, "unknown mailbox type '%s'", optarg);
+            types |= 1u << t;
+            break;
+        }
+        case 'S':
+            serial = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            mbox_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        mbox_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (zl_read_reg(fd, ZL_REG_ID, id, sizeof(id)) < 0)
+        errx(EXIT_FAILURE, "read ZL_REG_ID failed");
+    zl_mb_counts(&cfg, (uint16_t)((id[0] << 8) | id[1]));
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        if (types && !(types & (1u << t)))
+            cfg.count[t] = 0;
+    }
+
+    uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+    rc = zl_mb_read_all(fd, &cfg, !serial);
+    uint64_t t1 = zl_now_ns(CLOCK_MONOTONIC);
+
+    if (rc < 0)
+        errx(EXIT_FAILURE, "mailbox readout failed: %s", strerror(-rc));
+
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        for (unsigned int i = 0; i < cfg.count[t]; i++) {
+            if (out_format != ZL_FMT_TEXT) {
+                static struct zl_rec rec;
+
+                zl_rec_begin(&rec);
+                zl_rec_str(&rec, "type", mb_types[t].name);
+                zl_rec_u64(&rec, "index", i);
+                zl_rec_bytes(&rec, "data", cfg.data[t][i], ZL_MB_DATA_LEN);
+                if (zl_rec_end(&rec) < 0)
+                    errx(EXIT_FAILURE, "write mailbox record failed");
+                continue;
+            }
+            printf("%s%u:", mb_types[t].name, i);
+            for (size_t k = 0; k < ZL_MB_DATA_LEN; k++)
+                printf(" %02X", cfg.data[t][i][k]);
+            printf("\n");
+        }
+    }
+
+    if (verbose)
+        fprintf(stderr, "mbox: %s readout in %llu us, %lu messages, %lu semaphore polls\n",
+                serial ? "serial" : "pipelined", (unsigned long long)((t1 - t0) / 1000),
+                cfg.nmsg, cfg.npoll);
+
+    return EXIT_SUCCESS;
+}
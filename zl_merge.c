@@ -0,0 +1,210 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * K-way timestamp merge of captures taken on several chips
+ * - One cursor per capture, kept in a binary min-heap keyed by the
+ *   timestamp of its next record (ties go to the earlier file)
+ * - Captures are streamed straight from their mappings; blocks a cursor
+ *   has left are dropped from memory, so the footprint does not grow
+ *   with capture length
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "zl3073x.h"
+#include "zl_capture.h"
+
+struct merge_cursor {
+    struct zl_cap cap;
+    size_t blk;
+    uint32_t rec;
+    uint64_t ts;      /* timestamp of the current record */
+    size_t src;       /* position on the command line */
+};
+
+static const uint8_t *
+cursor_rec(const struct merge_cursor *c)
+{
+    return c->cap.idx[c->blk].recs + (size_t)c->rec * c->cap.rec_size;
+}
+
+static void
+cursor_drop_block(struct merge_cursor *c, size_t blk)
+{
+    madvise((void *)(c->cap.idx[blk].recs - sizeof(struct zl_cap_block_hdr)),
+            c->cap.block_size, MADV_DONTNEED);
+}
+
+/* Move to the next record within [from, to]; false once exhausted */
+static bool
+cursor_next(struct merge_cursor *c, uint64_t from, uint64_t to, bool first)
+{
+    if (!first)
+        c->rec++;
+
+    while (c->blk < c->cap.nblocks) {
+        if (c->rec >= c->cap.idx[c->blk].nrec) {
+            cursor_drop_block(c, c->blk);
+            c->blk++;
+            c->rec = 0;
+            continue;
+        }
+        c->ts = zl_cap_rec_ts(cursor_rec(c));
+        if (c->ts > to)
+            break;
+        if (c->ts >= from)
+            return true;
+        c->rec++;
+    }
+    return false;
+}
+
+static bool
+cursor_before(const struct merge_cursor *a, const struct merge_cursor *b)
+{
+    return a->ts < b->ts || (a->ts == b->ts && a->src < b->src);
+}
+
+static void
+heap_down(struct merge_cursor **heap, size_t n, size_t i)
+{
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+
+        if (l < n && cursor_before(heap[l], heap[m]))
+            m = l;
+        if (r < n && cursor_before(heap[r], heap[m]))
+            m = r;
+        if (m == i)
+            return;
+
+        struct merge_cursor *t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+static void
+merge_usage(void)
+{
+    fprintf(stderr,
+        "Usage: merge [-f from] [-t to] [-o output] capture...\n"
+        "  -f  first timestamp (same forms as read)\n"
+        "  -t  last timestamp, or +SECONDS after -f\n"
+        "  -o  write to a file instead of stdout\n"
+        "Each line is prefixed with the index of its capture, listed in the\n"
+        "leading '#' lines.\n"
+    );
+}
+
+int
+cmd_merge(int fd, int argc, char **argv)
+{
+    const char *from_s = NULL, *to_s = NULL, *output = NULL;
+    uint64_t from = 0, to = UINT64_MAX;
+    FILE *out = stdout;
+    int opt, rc;
+
+    (void)fd;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "f:t:o:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            from_s = optarg;
+            break;
+        case 't':
+            to_s = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'h':
+        default:
+            merge_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        merge_usage();
+        return EXIT_FAILURE;
+    }
+
+    if (from_s && zl_parse_time(from_s, 0, &from) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", from_s);
+    if (to_s && zl_parse_time(to_s, from, &to) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", to_s);
+
+    size_t ncap = (size_t)(argc - optind);
+    struct merge_cursor *cur = calloc(ncap, sizeof(*cur));
+    struct merge_cursor **heap = calloc(ncap, sizeof(*heap));
+    size_t nheap = 0;
+
+    if (!cur || !heap)
+        err(EXIT_FAILURE, "calloc");
+
+    if (output) {
+        out = fopen(output, "w");
+        if (!out)
+            err(EXIT_FAILURE, "open %s", output);
+    }
+
+    for (size_t i = 0; i < ncap; i++) {
+        const char *path = argv[optind + (int)i];
+
+        rc = zl_cap_open(&cur[i].cap, path);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "open capture %s: %s", path, strerror(-rc));
+        cur[i].src = i;
+        cur[i].blk = zl_cap_seek(&cur[i].cap, from);
+        fprintf(out, "# %zu %s %s chip 0x%04X\n", i, path,
+                cur[i].cap.devnode[0] ? cur[i].cap.devnode : "-", cur[i].cap.chip_id);
+        if (cursor_next(&cur[i], from, to, true))
+            heap[nheap++] = &cur[i];
+    }
+
+    for (size_t i = nheap / 2; i-- > 0; )
+        heap_down(heap, nheap, i);
+
+    static char line[ZL_SAMPLE_LINE_MAX];
+    uint64_t nsamples = 0;
+
+    while (nheap) {
+        struct merge_cursor *c = heap[0];
+
+        size_t n = zl_format_sample(line, sizeof(line), c->ts, c->cap.watch,
+                                    c->cap.nwatch, cursor_rec(c) + sizeof(uint64_t));
+        fprintf(out, "%zu ", c->src);
+        fwrite(line, 1, n, out);
+        nsamples++;
+
+        if (!cursor_next(c, from, to, false))
+            heap[0] = heap[--nheap];
+        heap_down(heap, nheap, 0);
+    }
+
+    if (debug > 0)
+        fprintf(stderr, "merged %llu samples from %zu captures\n",
+                (unsigned long long)nsamples, ncap);
+
+    if (output && fclose(out) != 0)
+        err(EXIT_FAILURE, "write %s", output);
+    else if (!output)
+        fflush(out);
+
+    for (size_t i = 0; i < ncap; i++)
+        zl_cap_close(&cur[i].cap);
+    free(heap);
+    free(cur);
+
+    return EXIT_SUCCESS;
+}
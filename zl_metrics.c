@@ -0,0 +1,258 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Text metrics endpoint of the polling mode (poll --metrics SPEC)
+ * - The polling loop publishes a snapshot of what it already read at the
+ *   end of each cycle; a scrape renders that copy and never touches the
+ *   bus, however often collectors come
+ * - Publishing is a sequence count around a copy (seqlock): the loop never
+ *   waits on a scrape, a scrape that raced an update copies again
+ * - One server thread accepts on the socket (zl_socket_bind() forms),
+ *   answers each connection with an HTTP/1.0 response in the Prometheus
+ *   text format and closes it; it runs at normal priority, started before
+ *   the loop enters real-time mode
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+#define METRICS_BODY_MAX  32768
+
+/* SPI message duration histogram bounds: 2^k ns, 1 us to 16.7 ms */
+#define METRICS_LAT_MIN_LOG2  10
+#define METRICS_LAT_MAX_LOG2  24
+
+static struct {
+    int fd;
+    pthread_t thread;
+    unsigned int seq;           /* odd while the snapshot is being written */
+    unsigned long nscrapes;
+    struct zl_metrics_snap snap;
+    char body[METRICS_BODY_MAX];
+    char scratch[METRICS_BODY_MAX + 256];
+} metrics = { .fd = -1 };
+
+/* Make *s the snapshot served to scrapes */
+void
+zl_metrics_publish(const struct zl_metrics_snap *s)
+{
+    if (metrics.fd < 0)
+        return;
+    __atomic_store_n(&metrics.seq, metrics.seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&metrics.snap, s, sizeof(*s));
+    __atomic_store_n(&metrics.seq, metrics.seq + 1, __ATOMIC_RELEASE);
+}
+
+static void
+metrics_copy(struct zl_metrics_snap *s)
+{
+    unsigned int seq;
+
+    do {
+        while ((seq = __atomic_load_n(&metrics.seq, __ATOMIC_ACQUIRE)) & 1)
+            sched_yield();
+        memcpy(s, &metrics.snap, sizeof(*s));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&metrics.seq, __ATOMIC_RELAXED) != seq);
+}
+
+static size_t
+metrics_render(char *buf, size_t size, const struct zl_metrics_snap *s)
+{
+    size_t n = 0;
+
+#define APPEND(...) do {                                                 \
+        int _r = snprintf(buf + n, n < size ? size - n : 0, __VA_ARGS__);   \
+        if (_r > 0)                                                      \
+            n += (size_t)_r;                                             \
+    } while (0)
+#define HEAD(name, type, help) \
+        APPEND("# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+    HEAD("zl_info", "gauge", "Device node and chip identity");
+    APPEND("zl_info{device=\"%s\",chip_id=\"0x%04X\",chip=\"%s\"} 1\n", devnode, s->chip_id,
+           zl_chip_caps(s->chip_id)->name);
+    HEAD("zl_samples_total", "counter", "Polling cycles completed");
+    APPEND("zl_samples_total %llu\n", (unsigned long long)s->samples);
+    HEAD("zl_last_sample_timestamp_seconds", "gauge", "Time of the last polling cycle");
+    APPEND("zl_last_sample_timestamp_seconds %llu.%09llu\n",
+           (unsigned long long)(s->ts_ns / 1000000000u), (unsigned long long)(s->ts_ns % 1000000000u));
+    HEAD("zl_poll_late_intervals_total", "counter", "Intervals longer than 1.5 times the target");
+    APPEND("zl_poll_late_intervals_total %llu\n", (unsigned long long)s->late);
+
+    HEAD("zl_spi_messages_total", "counter", "SPI messages (ioctls) sent");
+    APPEND("zl_spi_messages_total %llu\n", (unsigned long long)s->messages);
+    HEAD("zl_spi_transfers_total", "counter", "SPI transfers sent, several per message");
+    APPEND("zl_spi_transfers_total %llu\n", (unsigned long long)s->transfers);
+    HEAD("zl_spi_bytes_total", "counter", "SPI bytes clocked");
+    APPEND("zl_spi_bytes_total %llu\n", (unsigned long long)s->bytes);
+
+    HEAD("zl_spi_message_duration_seconds", "histogram", "Duration of the polling SPI message");
+    for (unsigned int k = METRICS_LAT_MIN_LOG2; k <= METRICS_LAT_MAX_LOG2; k++)
+        APPEND("zl_spi_message_duration_seconds_bucket{le=\"%.9g\"} %llu\n", ldexp(1e-9, (int)k),
+               (unsigned long long)zl_lat_below(&s->spi_lat, k));
+    APPEND("zl_spi_message_duration_seconds_bucket{le=\"+Inf\"} %llu\n",
+           (unsigned long long)s->spi_lat.n);
+    APPEND("zl_spi_message_duration_seconds_sum %.9f\n", (double)s->spi_lat.sum_ns / 1e9);
+    APPEND("zl_spi_message_duration_seconds_count %llu\n", (unsigned long long)s->spi_lat.n);
+
+    HEAD("zl_ref_status", "gauge", "Reference monitor status bits, 0 = OK");
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++)
+        APPEND("zl_ref_status{ref=\"%s\"} %u\n", zl_ref_name(r), s->ref_status[r]);
+    HEAD("zl_ref_ok", "gauge", "1 when no reference monitor is flagged");
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++)
+        APPEND("zl_ref_ok{ref=\"%s\"} %u\n", zl_ref_name(r), !s->ref_status[r]);
+
+    HEAD("zl_dpll_state", "gauge", "DPLL lock state: 0 acquiring, 1 locked, 2 holdover");
+    for (unsigned int c = 0; c < s->nchan; c++)
+        APPEND("zl_dpll_state{dpll=\"%u\"} %u\n", c, s->dpll_mon[c] & ZL_DPLL_MON_STATE_MASK);
+    HEAD("zl_dpll_locked", "gauge", "1 while the DPLL is locked");
+    for (unsigned int c = 0; c < s->nchan; c++)
+        APPEND("zl_dpll_locked{dpll=\"%u\"} %u\n", c,
+               (s->dpll_mon[c] & ZL_DPLL_MON_STATE_MASK) == ZL_DPLL_MON_STATE_LOCK);
+    HEAD("zl_dpll_holdover_ready", "gauge", "1 once holdover data is valid");
+    for (unsigned int c = 0; c < s->nchan; c++)
+        APPEND("zl_dpll_holdover_ready{dpll=\"%u\"} %u\n", c,
+               !!(s->dpll_mon[c] & ZL_DPLL_MON_HO_READY));
+    HEAD("zl_dpll_selected_ref", "gauge", "Reference index selected by the DPLL");
+    for (unsigned int c = 0; c < s->nchan; c++)
+        APPEND("zl_dpll_selected_ref{dpll=\"%u\"} %u\n", c,
+               s->dpll_refsel[c] & ZL_DPLL_REFSEL_REF_MASK);
+    HEAD("zl_dpll_mode", "gauge", "DPLL mode: 0 freerun, 1 holdover, 2 reflock, 3 auto, 4 nco");
+    for (unsigned int c = 0; c < s->nchan; c++)
+        APPEND("zl_dpll_mode{dpll=\"%u\"} %u\n", c, s->dpll_mode[c] & ZL_DPLL_MODE_MASK);
+
+    if (s->nphase) {
+        HEAD("zl_dpll_phase_error_seconds", "gauge", "Last DPLL phase error (--tie channels)");
+        for (size_t i = 0; i < s->nphase; i++)
+            APPEND("zl_dpll_phase_error_seconds{dpll=\"%u\"} %.12g\n", s->phase[i].chan,
+                   (double)s->phase[i].last_ps * 1e-12);
+        HEAD("zl_dpll_phase_error_min_seconds", "gauge", "Smallest phase error since start");
+        for (size_t i = 0; i < s->nphase; i++)
+            APPEND("zl_dpll_phase_error_min_seconds{dpll=\"%u\"} %.12g\n", s->phase[i].chan,
+                   (double)s->phase[i].min_ps * 1e-12);
+        HEAD("zl_dpll_phase_error_max_seconds", "gauge", "Largest phase error since start");
+        for (size_t i = 0; i < s->nphase; i++)
+            APPEND("zl_dpll_phase_error_max_seconds{dpll=\"%u\"} %.12g\n", s->phase[i].chan,
+                   (double)s->phase[i].max_ps * 1e-12);
+        HEAD("zl_dpll_phase_error_mean_seconds", "gauge", "Mean phase error since start");
+        for (size_t i = 0; i < s->nphase; i++)
+            APPEND("zl_dpll_phase_error_mean_seconds{dpll=\"%u\"} %.12g\n", s->phase[i].chan,
+                   s->phase[i].mean_ps * 1e-12);
+        HEAD("zl_dpll_phase_error_stddev_seconds", "gauge", "Phase error standard deviation");
+        for (size_t i = 0; i < s->nphase; i++)
+            APPEND("zl_dpll_phase_error_stddev_seconds{dpll=\"%u\"} %.12g\n", s->phase[i].chan,
+                   s->phase[i].n ? sqrt(s->phase[i].m2 / (double)s->phase[i].n) * 1e-12 : 0);
+    }
+
+    if (s->alarms) {
+        HEAD("zl_sticky_alarms_total", "counter", "Sticky alarm events harvested (--alarms)");
+        APPEND("zl_sticky_alarms_total %llu\n", (unsigned long long)s->nalarms);
+    }
+
+    HEAD("zl_metrics_scrapes_total", "counter", "Scrapes served, this one included");
+    APPEND("zl_metrics_scrapes_total %lu\n", metrics.nscrapes);
+
+#undef HEAD
+#undef APPEND
+
+    return n < size ? n : size - 1;
+}
+
+static void
+metrics_serve(int cfd)
+{
+    static struct zl_metrics_snap s;
+    struct timeval tv = { .tv_sec = 1 };
+    char req[1024];
+
+    /* the request is not parsed: every path gets the metrics */
+    setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (recv(cfd, req, sizeof(req), 0) < 0 && errno != EAGAIN)
+        return;
+
+    metrics.nscrapes++;
+    metrics_copy(&s);
+
+    size_t blen = metrics_render(metrics.body, sizeof(metrics.body), &s);
+    int hlen = snprintf(metrics.scratch, sizeof(metrics.scratch),
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\n\r\n", blen);
+
+    memcpy(metrics.scratch + hlen, metrics.body, blen);
+
+    const char *p = metrics.scratch;
+    size_t left = (size_t)hlen + blen;
+
+    while (left) {
+        ssize_t w = send(cfd, p, left, MSG_NOSIGNAL);
+
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return;
+        p += w;
+        left -= (size_t)w;
+    }
+}
+
+static void *
+metrics_thread(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        int cfd = accept4(metrics.fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;      /* shut down by zl_metrics_stop() */
+        }
+        metrics_serve(cfd);
+        close(cfd);
+    }
+    return NULL;
+}
+
+/* Listen on spec and serve the published snapshot; -errno on failure */
+int
+zl_metrics_start(const char *spec)
+{
+    int fd = zl_socket_bind(spec, SOCK_STREAM);
+    int rc;
+
+    if (fd < 0)
+        return fd;
+    metrics.fd = fd;
+    rc = pthread_create(&metrics.thread, NULL, metrics_thread, NULL);
+    if (rc) {
+        close(fd);
+        metrics.fd = -1;
+        return -rc;
+    }
+    return 0;
+}
+
+void
+zl_metrics_stop(void)
+{
+    if (metrics.fd < 0)
+        return;
+    shutdown(metrics.fd, SHUT_RDWR);
+    pthread_join(metrics.thread, NULL);
+    close(metrics.fd);
+    metrics.fd = -1;
+}
@@ -0,0 +1,113 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Local sockets used by the long-running modes
+ * - "unix:PATH"   Unix domain socket (a stale PATH is replaced)
+ * - "HOST:PORT"   IPv4/IPv6 address
+ * - "PORT"        loopback only
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+static int
+bind_unix(const char *path, int socktype)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof(sun.sun_path))
+        return -ENAMETOOLONG;
+    strcpy(sun.sun_path, path);
+
+    fd = socket(AF_UNIX, socktype | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        int rc = -errno;
+        close(fd);
+        return rc;
+    }
+    return fd;
+}
+
+static int
+bind_inet(const char *host, const char *port, int socktype)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = socktype,
+        .ai_flags = AI_PASSIVE | AI_NUMERICSERV,
+    };
+    struct addrinfo *res, *ai;
+    int fd = -EADDRNOTAVAIL;
+
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -EINVAL;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        int one = 1;
+
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            fd = -errno;
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -errno;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+/* Bound (and for SOCK_STREAM, listening) socket for spec, or -errno */
+int
+zl_socket_bind(const char *spec, int socktype)
+{
+    char host[256];
+    const char *colon;
+    int fd;
+
+    if (!strncmp(spec, "unix:", 5)) {
+        fd = bind_unix(spec + 5, socktype);
+    } else if ((colon = strrchr(spec, ':')) != NULL) {
+        size_t hl = (size_t)(colon - spec);
+
+        if (hl >= sizeof(host))
+            return -EINVAL;
+        memcpy(host, spec, hl);
+        host[hl] = '\0';
+        /* allow [v6addr]:port */
+        if (hl >= 2 && host[0] == '[' && host[hl - 1] == ']') {
+            memmove(host, host + 1, hl - 2);
+            host[hl - 2] = '\0';
+        }
+        fd = bind_inet(host[0] ? host : NULL, colon + 1, socktype);
+    } else {
+        fd = bind_inet("localhost", spec, socktype);
+    }
+
+    if (fd >= 0 && socktype == SOCK_STREAM && listen(fd, 8) < 0) {
+        int rc = -errno;
+        close(fd);
+        return rc;
+    }
+
+    return fd;
+}
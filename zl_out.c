@@ -0,0 +1,326 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Structured output (-F json, jsonl or csv)
+ * - A record is formatted field by field into a fixed buffer owned by
+ *   the caller, with hand-rolled number conversions: no allocation and
+ *   no stdio on the way
+ * - Each record is then one write() to stdout (writev() for the first
+ *   CSV record, whose column names were collected along the way)
+ * - json is one array of records ([] without any), closed by
+ *   zl_out_finish() or at exit, so commands failing through errx() still
+ *   leave a valid document; jsonl is one object per line; csv has one
+ *   header line, then one line per record, so a command keeps the same
+ *   fields in every record
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "zl3073x.h"
+
+static const char *const format_names[] = {
+    [ZL_FMT_TEXT]  = "text",
+    [ZL_FMT_JSON]  = "json",
+    [ZL_FMT_JSONL] = "jsonl",
+    [ZL_FMT_CSV]   = "csv",
+};
+
+static unsigned long out_records;
+
+/* Format by name, -EINVAL if unknown */
+int
+zl_format_parse(const char *s)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(format_names); i++) {
+        if (!strcmp(s, format_names[i]))
+            return (int)i;
+    }
+    return -EINVAL;
+}
+
+static void
+rec_put(struct zl_rec *r, const char *s, size_t len)
+{
+    if (r->len + len > sizeof(r->buf)) {
+        r->full = true;
+        return;
+    }
+    memcpy(r->buf + r->len, s, len);
+    r->len += len;
+}
+
+static void
+rec_putc(struct zl_rec *r, char c)
+{
+    rec_put(r, &c, 1);
+}
+
+static void
+rec_put_u64(struct zl_rec *r, uint64_t v)
+{
+    char tmp[20];
+    size_t n = sizeof(tmp);
+
+    do {
+        tmp[--n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    rec_put(r, tmp + n, sizeof(tmp) - n);
+}
+
+static void
+rec_put_hex(struct zl_rec *r, const uint8_t *p, size_t len)
+{
+    static const char digits[] = "0123456789ABCDEF";
+
+    if (r->len + 2 * len > sizeof(r->buf)) {
+        r->full = true;
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        r->buf[r->len++] = digits[p[i] >> 4];
+        r->buf[r->len++] = digits[p[i] & 0xF];
+    }
+}
+
+/* JSON string, or CSV field quoted when it has to be */
+static void
+rec_put_str(struct zl_rec *r, const char *s)
+{
+    if (out_format == ZL_FMT_CSV) {
+        if (!strpbrk(s, ",\"\n")) {
+            rec_put(r, s, strlen(s));
+            return;
+        }
+        rec_putc(r, '"');
+        for (; *s; s++) {
+            if (*s == '"')
+                rec_putc(r, '"');
+            rec_putc(r, *s);
+        }
+        rec_putc(r, '"');
+        return;
+    }
+
+    rec_putc(r, '"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c == '"' || c == '\\') {
+            rec_putc(r, '\\');
+            rec_putc(r, (char)c);
+        } else if (c < 0x20) {
+            uint8_t b = c;
+
+            rec_put(r, "\\u00", 4);
+            rec_put_hex(r, &b, 1);
+        } else {
+            rec_putc(r, (char)c);
+        }
+    }
+    rec_putc(r, '"');
+}
+
+/* Separator and key of the next field; the CSV header gets the key */
+static void
+rec_key(struct zl_rec *r, const char *key)
+{
+    if (out_format == ZL_FMT_CSV) {
+        if (r->nfields)
+            rec_putc(r, ',');
+        if (out_records == 0) {
+            size_t klen = strlen(key);
+
+            if (r->hlen + klen + 1 < sizeof(r->hdr)) {
+                if (r->nfields)
+                    r->hdr[r->hlen++] = ',';
+                memcpy(r->hdr + r->hlen, key, klen);
+                r->hlen += klen;
+            } else {
+                r->full = true;
+            }
+        }
+    } else {
+        rec_put(r, r->nfields ? ",\"" : "\"", r->nfields ? 2 : 1);
+        rec_put(r, key, strlen(key));
+        rec_put(r, "\":", 2);
+    }
+    r->nfields++;
+}
+
+void
+zl_rec_begin(struct zl_rec *r)
+{
+    r->len = r->hlen = 0;
+    r->nfields = 0;
+    r->full = false;
+    if (out_format == ZL_FMT_JSON)
+        rec_put(r, out_records ? ",\n{" : "[\n{", 3);
+    else if (out_format == ZL_FMT_JSONL)
+        rec_putc(r, '{');
+}
+
+void
+zl_rec_str(struct zl_rec *r, const char *key, const char *val)
+{
+    rec_key(r, key);
+    rec_put_str(r, val);
+}
+
+void
+zl_rec_u64(struct zl_rec *r, const char *key, uint64_t val)
+{
+    rec_key(r, key);
+    rec_put_u64(r, val);
+}
+
+void
+zl_rec_s64(struct zl_rec *r, const char *key, int64_t val)
+{
+    rec_key(r, key);
+    if (val < 0)
+        rec_putc(r, '-');
+    rec_put_u64(r, val < 0 ? -(uint64_t)val : (uint64_t)val);
+}
+
+void
+zl_rec_bool(struct zl_rec *r, const char *key, bool val)
+{
+    rec_key(r, key);
+    rec_put(r, val ? "true" : "false", val ? 4 : 5);
+}
+
+/* "0x" and 2 * len hex digits, as a string */
+void
+zl_rec_hex(struct zl_rec *r, const char *key, uint64_t val, size_t len)
+{
+    uint8_t be[8];
+
+    for (size_t i = 0; i < len && i < sizeof(be); i++)
+        be[i] = (uint8_t)(val >> (8 * (len - 1 - i)));
+    rec_key(r, key);
+    if (out_format != ZL_FMT_CSV)
+        rec_putc(r, '"');
+    rec_put(r, "0x", 2);
+    rec_put_hex(r, be, len < sizeof(be) ? len : sizeof(be));
+    if (out_format != ZL_FMT_CSV)
+        rec_putc(r, '"');
+}
+
+/* Raw bytes as one hex string */
+void
+zl_rec_bytes(struct zl_rec *r, const char *key, const uint8_t *p, size_t len)
+{
+    rec_key(r, key);
+    if (out_format != ZL_FMT_CSV)
+        rec_putc(r, '"');
+    rec_put_hex(r, p, len);
+    if (out_format != ZL_FMT_CSV)
+        rec_putc(r, '"');
+}
+
+/* ns timestamp as seconds with 9 decimals */
+void
+zl_rec_ts(struct zl_rec *r, const char *key, uint64_t ns)
+{
+    char frac[10];
+    uint64_t f = ns % 1000000000u;
+
+    rec_key(r, key);
+    rec_put_u64(r, ns / 1000000000u);
+    frac[0] = '.';
+    for (int i = 9; i > 0; i--, f /= 10)
+        frac[i] = (char)('0' + f % 10);
+    rec_put(r, frac, sizeof(frac));
+}
+
+static int
+out_write(const struct iovec *iov, int n)
+{
+    struct iovec v[2];
+
+    /* text already buffered by stdio goes first */
+    if (fflush(stdout) == EOF)
+        return -errno;
+    memcpy(v, iov, (size_t)n * sizeof(*v));
+    while (n) {
+        ssize_t w = writev(STDOUT_FILENO, v, n);
+
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        while (n && (size_t)w >= v[0].iov_len) {
+            w -= (ssize_t)v[0].iov_len;
+            v[0] = v[1];
+            n--;
+        }
+        if (n) {
+            v[0].iov_base = (char *)v[0].iov_base + w;
+            v[0].iov_len -= (size_t)w;
+        }
+    }
+    return 0;
+}
+
+/* Write the record; -EMSGSIZE if it did not fit */
+int
+zl_rec_end(struct zl_rec *r)
+{
+    struct iovec iov[2];
+    int n = 0;
+
+    if (out_format == ZL_FMT_JSON)
+        rec_putc(r, '}');
+    else if (out_format == ZL_FMT_JSONL)
+        rec_put(r, "}\n", 2);
+    else
+        rec_putc(r, '\n');
+    if (r->full)
+        return -EMSGSIZE;
+
+    if (out_format == ZL_FMT_CSV && out_records == 0) {
+        r->hdr[r->hlen++] = '\n';
+        iov[n++] = (struct iovec){ .iov_base = r->hdr, .iov_len = r->hlen };
+    }
+    iov[n++] = (struct iovec){ .iov_base = r->buf, .iov_len = r->len };
+    out_records++;
+
+    return out_write(iov, n);
+}
+
+/* End of the output: closes the json array, [] without records; once */
+int
+zl_out_finish(void)
+{
+    static bool finished;
+    struct iovec iov;
+
+    if (out_format != ZL_FMT_JSON || finished)
+        return 0;
+    finished = true;
+    iov.iov_base = out_records ? "\n]\n" : "[]\n";
+    iov.iov_len = 3;
+    return out_write(&iov, 1);
+}
+
+/* Commands leaving through errx() still end with a valid json document */
+static void
+out_atexit(void)
+{
+    zl_out_finish();
+}
+
+void
+zl_out_start(void)
+{
+    if (out_format == ZL_FMT_JSON)
+        atexit(out_atexit);
+}
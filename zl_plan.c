@@ -0,0 +1,179 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Prebuilt SPI transaction templates ("plans")
+ * - Register accesses are planned once into a fixed spi_ioc_transfer
+ *   array backed by fixed tx/rx buffers
+ * - A page select is only inserted when the page changes, and reads of
+ *   contiguous registers on one page are coalesced into a single burst
+ * - Each submit is one SPI_IOC_MESSAGE ioctl (one per page for bulk work
+ *   under the bus scheduler); read data is then found at the rx offsets
+ *   returned when the plan was built
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "zl3073x.h"
+
+void
+zl_plan_init(struct zl_plan *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->page = -1;
+}
+
+static struct spi_ioc_transfer *
+plan_xfer(struct zl_plan *p, size_t len, bool read)
+{
+    if (p->nxfer == ZL_PLAN_MAX_XFERS || p->len + len > ZL_PLAN_BUF)
+        return NULL;
+
+    struct spi_ioc_transfer *x = &p->xfer[p->nxfer];
+
+    /* every register access is its own chip-select framed transaction */
+    if (p->nxfer)
+        p->xfer[p->nxfer - 1].cs_change = 1;
+
+    memset(x, 0, sizeof(*x));
+    x->tx_buf = (unsigned long)(p->tx + p->len);
+    x->rx_buf = read ? (unsigned long)(p->rx + p->len) : 0;
+    x->len = (uint32_t)len;
+    x->speed_hz = speed_hz;
+    x->bits_per_word = bits_per_word;
+
+    p->nxfer++;
+    p->len += len;
+    p->last_read = read;
+
+    return x;
+}
+
+static int
+plan_page(struct zl_plan *p, uint8_t page)
+{
+    if (p->page == page)
+        return 0;
+
+    uint8_t *tx = p->tx + p->len;
+
+    if (!plan_xfer(p, 2, false))
+        return -ENOSPC;
+    tx[0] = ZL_PAGE_SEL;
+    tx[1] = page;
+    p->page = page;
+
+    return 0;
+}
+
+/* Plan a read of len bytes at reg; returns the rx offset of the data */
+int
+zl_plan_read(struct zl_plan *p, uint16_t reg, size_t len)
+{
+    uint8_t off = ZL_REG_OFF(reg);
+
+    if (len == 0 || off + len > ZL_PAGE_SEL)
+        return -EINVAL;
+    if (plan_page(p, ZL_REG_PAGE(reg)) < 0)
+        return -ENOSPC;
+
+    /* extend the previous burst when this read directly follows it */
+    if (p->nxfer && p->last_read && p->last_end == reg &&
+        p->len + len <= ZL_PLAN_BUF) {
+        p->xfer[p->nxfer - 1].len += (uint32_t)len;
+        p->len += len;
+        p->last_end = (uint16_t)(reg + len);
+        return (int)(p->len - len);
+    }
+
+    uint8_t *tx = p->tx + p->len;
+
+    if (!plan_xfer(p, len + 1, true))
+        return -ENOSPC;
+    tx[0] = 0x80 | off;
+    p->last_end = (uint16_t)(reg + len);
+
+    return (int)(p->len - len);
+}
+
+/* Plan a write; returns the tx offset of the data so it can be patched */
+int
+zl_plan_write(struct zl_plan *p, uint16_t reg, const uint8_t *data, size_t len)
+{
+    uint8_t off = ZL_REG_OFF(reg);
+
+    if (len == 0 || off + len > ZL_PAGE_SEL)
+        return -EINVAL;
+    if (plan_page(p, ZL_REG_PAGE(reg)) < 0)
+        return -ENOSPC;
+
+    uint8_t *tx = p->tx + p->len;
+
+    if (!plan_xfer(p, len + 1, false))
+        return -ENOSPC;
+    tx[0] = off;
+    if (data)
+        memcpy(tx + 1, data, len);
+
+    return (int)(p->len - len);
+}
+
+/*
+ * Bulk plans under the bus scheduler: one message per page select and
+ * the accesses after it, each a transaction that higher classes can
+ * preempt. Every segment selects its page, so the split keeps the plan
+ * correct whatever ran in between.
+ */
+static int
+plan_submit_pages(int fd, struct zl_plan *p)
+{
+    unsigned int start = 0;
+
+    for (unsigned int i = 1; i <= p->nxfer; i++) {
+        const uint8_t *tx = i < p->nxfer ? (const uint8_t *)(uintptr_t)p->xfer[i].tx_buf : NULL;
+
+        if (tx && !(p->xfer[i].len == 2 && !p->xfer[i].rx_buf && tx[0] == ZL_PAGE_SEL))
+            continue;
+
+        /* the chip select must drop at the end of each message */
+        uint8_t cs = p->xfer[i - 1].cs_change;
+        int rc;
+
+        p->xfer[i - 1].cs_change = 0;
+        rc = spi_transfer(fd, p->xfer + start, i - start);
+        p->xfer[i - 1].cs_change = cs;
+        if (rc < 0)
+            return rc;
+        start = i;
+    }
+    return 0;
+}
+
+int
+zl_plan_submit(int fd, struct zl_plan *p)
+{
+    if (!p->nxfer)
+        return 0;
+
+    if (debug > 0)
+        fprintf(stderr, "PLAN: %u transfers, %zu bytes\n", p->nxfer, p->len);
+
+    int rc = zl_bus_preemptible() ? plan_submit_pages(fd, p)
+                                  : spi_transfer(fd, p->xfer, p->nxfer);
+
+    if (rc == 0 && debug > 0) {
+        for (unsigned int i = 0; i < p->nxfer; i++) {
+            const uint8_t *tx = (const uint8_t *)(uintptr_t)p->xfer[i].tx_buf;
+            const uint8_t *rx = (const uint8_t *)(uintptr_t)p->xfer[i].rx_buf;
+            char pfx[64];
+
+            snprintf(pfx, sizeof(pfx), "  %s off=0x%02X %s=", rx ? "R" : "W",
+                     tx[0] & 0x7F, rx ? "rx" : "data");
+            hexdump(pfx, rx ? rx + 1 : tx + 1, p->xfer[i].len - 1);
+        }
+    }
+
+    return rc;
+}
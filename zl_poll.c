@@ -0,0 +1,677 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Polling mode: sample a watchlist of registers at a fixed interval,
+ * either as text lines on stdout or into a binary capture file
+ *
+ * The watchlist is compiled once into a transaction plan; every cycle is
+ * then a single ioctl followed by copies from precomputed rx offsets.
+ * DPLL phase errors requested with --tie also feed streaming MTIE/TDEV,
+ * and reference frequency offsets requested with --adev streaming ADEV.
+ * Both can also be exported as per-interval quantile sketches (--sketch).
+ * With --refs and --dplls, reference monitor and DPLL state changes are
+ * reported on stderr; with --alarms, sticky alarms are harvested from the
+ * same message and cleared (a second ioctl only in cycles where some fired).
+ * With --metrics, what each cycle read is published to a text metrics
+ * endpoint; scrapes are answered from that copy, never from the bus.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zl3073x.h"
+#include "zl_capture.h"
+#include "zl_sketch.h"
+#include "zl_stats.h"
+
+enum {
+    OPT_TAU_MAX = 256,
+    OPT_REPORT,
+    OPT_SKETCH,
+    OPT_SKETCH_INTERVAL,
+    OPT_REFS,
+    OPT_DPLLS,
+    OPT_ALARMS,
+    OPT_METRICS,
+};
+
+/* Analytics state shared by the periodic and final reports */
+struct poll_stats {
+    size_t ntie;
+    unsigned int tie_chan[ZL_MAX_CHANNELS];
+    struct zl_tie_stats tie[ZL_MAX_CHANNELS];
+    uint16_t adev_mask;
+    unsigned long tie_busy, adev_busy;
+    struct zl_adev_stats adev[ZL_NUM_REFS];
+    struct zl_sketch_writer sk;
+    int sk_tie[ZL_MAX_CHANNELS], sk_adev[ZL_NUM_REFS];
+    struct zl_alarms alarms;
+};
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void
+poll_report(const struct poll_stats *st)
+{
+    char name[32];
+
+    for (size_t t = 0; t < st->ntie; t++) {
+        snprintf(name, sizeof(name), "dpll%u phase error", st->tie_chan[t]);
+        zl_tie_report(&st->tie[t], name, stderr);
+    }
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+        if (!(st->adev_mask & (1u << r)))
+            continue;
+        snprintf(name, sizeof(name), "ref%u FFO", r);
+        zl_adev_report(&st->adev[r], name, stderr);
+    }
+    if (st->tie_busy)
+        fprintf(stderr, "dpll phase error: %lu samples skipped (latch not complete)\n",
+                st->tie_busy);
+    if (st->adev_busy)
+        fprintf(stderr, "ref FFO: %lu samples skipped (measurement not complete)\n",
+                st->adev_busy);
+}
+
+/* Index of reg:len in the watchlist, appended if missing */
+static size_t
+poll_watch_add(struct zl_watch *watch, size_t *nwatch, size_t *payload_len,
+               uint16_t reg, uint8_t len)
+{
+    size_t i;
+
+    for (i = 0; i < *nwatch; i++) {
+        if (watch[i].reg == reg && watch[i].len == len)
+            return i;
+    }
+    if (*nwatch == ZL_CAP_MAX_WATCH)
+        errx(EXIT_FAILURE, "too many registers (max %d)", ZL_CAP_MAX_WATCH);
+    watch[i].reg = reg;
+    watch[i].len = len;
+    *payload_len += len;
+    (*nwatch)++;
+
+    return i;
+}
+
+/* Report reference monitor transitions (every reference on the first call) */
+static void
+poll_refs(uint64_t ts, const uint8_t *status, uint8_t *last, bool first)
+{
+    char desc[64];
+
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+        if (!first && status[r] == last[r])
+            continue;
+        zl_ref_mon_format(desc, sizeof(desc), status[r]);
+        fprintf(stderr, "%llu.%09llu %s: %s\n", (unsigned long long)(ts / 1000000000u),
+                (unsigned long long)(ts % 1000000000u), zl_ref_name(r), desc);
+        last[r] = status[r];
+    }
+}
+
+/* Same for DPLL channels; mode/refsel control bytes are strided by 4 */
+static void
+poll_dplls(uint64_t ts, const uint8_t *mon, const uint8_t *refsel, const uint8_t *ctrl,
+           unsigned int nchan, uint8_t (*last)[3], bool first)
+{
+    char desc[96];
+
+    for (unsigned int c = 0; c < nchan; c++) {
+        uint8_t cur[3] = { mon[c], refsel[c], ctrl[4 * c] };
+
+        if (!first && !memcmp(cur, last[c], sizeof(cur)))
+            continue;
+        zl_dpll_format(desc, sizeof(desc), cur[0], cur[1], cur[2]);
+        fprintf(stderr, "%llu.%09llu dpll%u: %s\n", (unsigned long long)(ts / 1000000000u),
+                (unsigned long long)(ts % 1000000000u), c, desc);
+        memcpy(last[c], cur, sizeof(cur));
+    }
+}
+
+/* Report and clear the sticky alarms latched since the last cycle */
+static void
+poll_alarms(int fd, struct zl_alarms *a, const uint8_t *sticky, uint64_t ts)
+{
+    struct zl_alarm_event ev[ZL_ALARM_MAX];
+    char desc[96];
+    int n = zl_alarms_harvest(fd, a, sticky, ts, ev);
+
+    if (n < 0)
+        errx(EXIT_FAILURE, "sticky alarm clear failed");
+    for (int i = 0; i < n; i++) {
+        zl_alarm_format(desc, sizeof(desc), &ev[i]);
+        fprintf(stderr, "%llu.%09llu alarm %s\n", (unsigned long long)(ts / 1000000000u),
+                (unsigned long long)(ts % 1000000000u), desc);
+    }
+}
+
+/* Welford running phase error statistics of one --tie channel */
+static void
+poll_metrics_phase(struct zl_metrics_snap *ms, size_t t, int64_t ps)
+{
+    struct zl_metrics_phase *ph = &ms->phase[t];
+    double d = (double)ps - ph->mean_ps;
+
+    if (!ph->n || ps < ph->min_ps)
+        ph->min_ps = ps;
+    if (!ph->n || ps > ph->max_ps)
+        ph->max_ps = ps;
+    ph->last_ps = ps;
+    ph->n++;
+    ph->mean_ps += d / (double)ph->n;
+    ph->m2 += d * ((double)ps - ph->mean_ps);
+}
+
+/* Update the --metrics snapshot from this cycle and publish it */
+static void
+poll_metrics(struct zl_metrics_snap *ms, const struct zl_plan *plan, const uint8_t *status,
+             const uint8_t *mon, const uint8_t *refsel, const uint8_t *ctrl,
+             const struct zl_alarms *a)
+{
+    ms->messages++;
+    ms->transfers += plan->nxfer;
+    ms->bytes += plan->len;
+    memcpy(ms->ref_status, status, ZL_NUM_REFS);
+    memcpy(ms->dpll_mon, mon, ms->nchan);
+    memcpy(ms->dpll_refsel, refsel, ms->nchan);
+    for (unsigned int c = 0; c < ms->nchan; c++)
+        ms->dpll_mode[c] = ctrl[4 * c];
+    if (a && a->nevents != ms->nalarms) {
+        /* this cycle's clear message */
+        ms->messages++;
+        ms->transfers += a->clear.nxfer;
+        ms->bytes += a->clear.len;
+        ms->nalarms = a->nevents;
+    }
+    zl_metrics_publish(ms);
+}
+
+/* Structured sample: fields up to 8 bytes as numbers, longer blocks as hex */
+static void
+poll_record(uint64_t ts, const struct zl_watch *watch, size_t nwatch, const uint8_t *payload)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    static struct zl_rec rec;
+    char key[7] = "0x";
+
+    zl_rec_begin(&rec);
+    zl_rec_ts(&rec, "ts", ts);
+    for (size_t i = 0; i < nwatch; i++) {
+        for (int k = 0; k < 4; k++)
+            key[2 + k] = digits[(watch[i].reg >> (12 - 4 * k)) & 0xF];
+        if (watch[i].len <= 8)
+            zl_rec_u64(&rec, key, zl_get_be(payload, watch[i].len));
+        else
+            zl_rec_bytes(&rec, key, payload, watch[i].len);
+        payload += watch[i].len;
+    }
+    if (zl_rec_end(&rec) < 0)
+        errx(EXIT_FAILURE, "write sample record failed");
+}
+
+static void
+poll_usage(void)
+{
+    fprintf(stderr,
+        "Usage: poll [-i interval_us] [-n count] [-o capture] [-v]\n"
+        "            [--realtime [--cpu N] [--prio N]] REG[:LEN]...\n"
+        "  -i  sampling interval in microseconds (default 1000000)\n"
+        "  -n  number of samples, 0 = until interrupted (default 0)\n"
+        "  -o  write a binary capture file instead of text lines\n"
+        "  -v  report sample-interval jitter on stderr\n"
+        "  -R, --realtime  lock and prefault memory, run SCHED_FIFO\n"
+        "  -c, --cpu       pin the polling thread to this CPU\n"
+        "  -p, --prio      SCHED_FIFO priority (default 50)\n"
+        "  -T, --tie N     MTIE/TDEV of DPLL channel N phase error (repeatable)\n"
+        "  -A, --adev[=M]  ADEV of the reference FFOs in mask M (default all)\n"
+        "      --tau-max S largest MTIE/TDEV/ADEV tau in seconds (default 1000)\n"
+        "      --report S  analytics report period in seconds (default 10)\n"
+        "      --sketch F  export phase/FFO quantile sketches to F\n"
+        "      --sketch-interval S  sketch interval in seconds (default 60)\n"
+        "      --refs      report reference monitor status changes on stderr\n"
+        "      --dplls     report DPLL lock state/mode changes on stderr\n"
+        "      --alarms    report and clear sticky reference/DPLL alarms on stderr\n"
+        "      --metrics SPEC  serve text metrics on [HOST:]PORT or unix:PATH\n"
+    );
+}
+
+int
+cmd_poll(int fd, int argc, char **argv)
+{
+    struct zl_watch watch[ZL_CAP_MAX_WATCH];
+    struct zl_cap_writer cap;
+    const char *output = NULL;
+    uint32_t interval_us = 1000000;
+    unsigned long count = 0;
+    size_t nwatch = 0, payload_len = 0;
+    bool realtime = false, verbose = false;
+    int cpu = -1, prio = 50;
+    int opt, rc;
+
+    static const struct option long_opts[] = {
+        {"realtime", no_argument, 0, 'R'},
+        {"cpu", required_argument, 0, 'c'},
+        {"prio", required_argument, 0, 'p'},
+        {"tie", required_argument, 0, 'T'},
+        {"adev", optional_argument, 0, 'A'},
+        {"tau-max", required_argument, 0, OPT_TAU_MAX},
+        {"report", required_argument, 0, OPT_REPORT},
+        {"sketch", required_argument, 0, OPT_SKETCH},
+        {"sketch-interval", required_argument, 0, OPT_SKETCH_INTERVAL},
+        {"refs", no_argument, 0, OPT_REFS},
+        {"dplls", no_argument, 0, OPT_DPLLS},
+        {"alarms", no_argument, 0, OPT_ALARMS},
+        {"metrics", required_argument, 0, OPT_METRICS},
+        {}
+    };
+    static struct poll_stats st;
+    unsigned int *tie_chan = st.tie_chan;
+    size_t ntie = 0;
+    double tau_max = 1000, report_s = 10;
+    const char *sketch = NULL;
+    uint32_t sketch_s = 60;
+    bool refs = false, dplls = false, alarms = false;
+    const char *metrics = NULL;
+
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "i:n:o:vRc:p:T:Ah", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_us = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'R':
+            realtime = true;
+            break;
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 'p':
+            prio = atoi(optarg);
+            break;
+        case 'T':
+            if (ntie == ARRAY_SIZE(st.tie_chan))
+                errx(EXIT_FAILURE, "at most %zu --tie channels", ARRAY_SIZE(st.tie_chan));
+            tie_chan[ntie] = (unsigned int)strtoul(optarg, NULL, 0);
+            if (tie_chan[ntie] >= ZL_MAX_CHANNELS)
+                errx(EXIT_FAILURE, "invalid DPLL channel %s", optarg);
+            ntie++;
+            break;
+        case 'A':
+            st.adev_mask = optarg ? (uint16_t)strtoul(optarg, NULL, 0)
+                                  : (uint16_t)((1u << ZL_NUM_REFS) - 1);
+            st.adev_mask &= (1u << ZL_NUM_REFS) - 1;
+            if (!st.adev_mask)
+                errx(EXIT_FAILURE, "invalid reference mask %s", optarg);
+            break;
+        case OPT_TAU_MAX:
+            tau_max = strtod(optarg, NULL);
+            break;
+        case OPT_REPORT:
+            report_s = strtod(optarg, NULL);
+            break;
+        case OPT_SKETCH:
+            sketch = optarg;
+            break;
+        case OPT_SKETCH_INTERVAL:
+            sketch_s = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case OPT_REFS:
+            refs = true;
+            break;
+        case OPT_DPLLS:
+            dplls = true;
+            break;
+        case OPT_ALARMS:
+            alarms = true;
+            break;
+        case OPT_METRICS:
+            metrics = optarg;
+            break;
+        case 'h':
+        default:
+            poll_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (; optind < argc; optind++) {
+        if (nwatch == ARRAY_SIZE(watch))
+            errx(EXIT_FAILURE, "too many registers (max %zu)", ARRAY_SIZE(watch));
+        if (zl_parse_watch(argv[optind], &watch[nwatch]) < 0)
+            errx(EXIT_FAILURE, "invalid register '%s'", argv[optind]);
+        payload_len += watch[nwatch].len;
+        nwatch++;
+    }
+
+    uint16_t chip_id = 0;
+
+    if (output || sketch || dplls || alarms || metrics || ntie) {
+        uint8_t id[2];
+        if (zl_read_reg(fd, ZL_REG_ID, id, sizeof(id)) < 0)
+            errx(EXIT_FAILURE, "read ZL_REG_ID failed");
+        chip_id = (uint16_t)((id[0] << 8) | id[1]);
+    }
+
+    /* status and measurements analysed are sampled (and captured) too */
+    size_t tie_watch[ZL_MAX_CHANNELS], adev_watch = 0, refs_watch = 0, dpll_watch[3] = {0};
+    size_t alarm_watch = 0;
+    unsigned int nchan = zl_chip_caps(chip_id)->channels;
+    uint8_t tie_mask = 0;
+
+    for (size_t t = 0; t < ntie; t++) {
+        if (tie_chan[t] >= nchan)
+            errx(EXIT_FAILURE, "--tie %u: no such DPLL channel on chip 0x%04X (0..%u)",
+                 tie_chan[t], chip_id, nchan - 1);
+        if (tie_mask & (1u << tie_chan[t]))
+            errx(EXIT_FAILURE, "--tie %u given twice", tie_chan[t]);
+        tie_watch[t] = poll_watch_add(watch, &nwatch, &payload_len,
+                                      ZL_REG_DPLL_PHASE_ERR_DATA(tie_chan[t]),
+                                      ZL_DPLL_PHASE_ERR_LEN);
+        tie_mask |= (uint8_t)(1u << tie_chan[t]);
+    }
+    if (st.adev_mask)
+        adev_watch = poll_watch_add(watch, &nwatch, &payload_len, ZL_REG_REF_FREQ(0),
+                                    ZL_NUM_REFS * ZL_REF_FREQ_LEN);
+    /* metrics need the state whether or not it is reported */
+    if (refs || metrics)
+        refs_watch = poll_watch_add(watch, &nwatch, &payload_len,
+                                    ZL_REG_REF_MON_STATUS(0), ZL_NUM_REFS);
+    if (dplls || metrics) {
+        dpll_watch[0] = poll_watch_add(watch, &nwatch, &payload_len,
+                                       ZL_REG_DPLL_MON_STATUS(0), (uint8_t)nchan);
+        dpll_watch[1] = poll_watch_add(watch, &nwatch, &payload_len,
+                                       ZL_REG_DPLL_REFSEL_STATUS(0), (uint8_t)nchan);
+        dpll_watch[2] = poll_watch_add(watch, &nwatch, &payload_len, ZL_REG_DPLL_MODE_REFSEL(0),
+                                       ZL_DPLL_MODE_SPAN(nchan));
+    }
+
+    if (alarms) {
+        zl_alarms_init(&st.alarms, nchan);
+        alarm_watch = poll_watch_add(watch, &nwatch, &payload_len, ZL_REG_REF_MON_STICKY(0),
+                                     (uint8_t)st.alarms.len);
+    }
+
+    if (nwatch == 0 || interval_us == 0) {
+        poll_usage();
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * FFO measurements and phase error latches are pipelined: each cycle
+     * checks that the request written at the end of the previous cycle
+     * completed (its register reads back 0), reads the results and writes
+     * the next request. The FFO trigger is a message of its own, sent only
+     * when the measurement reads back idle: retriggering a running one
+     * restarts it, so a slow measurement would never complete
+     */
+    static struct zl_plan plan, ffo_trig;
+    int rxoff[ZL_CAP_MAX_WATCH], ctrl_rxoff = -1, latch_rxoff = -1;
+    uint8_t ffo_cmd = ZL_REF_FREQ_MEAS_CTRL_FFO;
+    bool ffo_pending = false;
+
+    zl_plan_init(&plan);
+    zl_plan_init(&ffo_trig);
+    if (tie_mask)
+        latch_rxoff = zl_plan_read(&plan, ZL_REG_DPLL_PHASE_ERR_READ_MASK, 1);
+    if (st.adev_mask) {
+        uint8_t m[2] = { (uint8_t)st.adev_mask, (uint8_t)(st.adev_mask >> 8) };
+
+        if (zl_write_reg(fd, ZL_REG_REF_FREQ_MEAS_MASK, m, sizeof(m)) < 0)
+            errx(EXIT_FAILURE, "write ZL_REG_REF_FREQ_MEAS_MASK failed");
+        ctrl_rxoff = zl_plan_read(&plan, ZL_REG_REF_FREQ_MEAS_CTRL, 1);
+    }
+    for (size_t i = 0; i < nwatch && ctrl_rxoff != -ENOSPC; i++) {
+        rxoff[i] = zl_plan_read(&plan, watch[i].reg, watch[i].len);
+        if (rxoff[i] < 0)
+            ctrl_rxoff = -ENOSPC;
+    }
+    if (st.adev_mask && ctrl_rxoff >= 0 &&
+        zl_plan_write(&ffo_trig, ZL_REG_REF_FREQ_MEAS_CTRL, &ffo_cmd, 1) < 0)
+        ctrl_rxoff = -ENOSPC;
+    if (tie_mask && ctrl_rxoff != -ENOSPC &&
+        zl_plan_write(&plan, ZL_REG_DPLL_PHASE_ERR_READ_MASK, &tie_mask, 1) < 0)
+        ctrl_rxoff = -ENOSPC;
+    if (ctrl_rxoff == -ENOSPC)
+        errx(EXIT_FAILURE, "watchlist does not fit one SPI message (%d bytes, %d transfers)",
+             ZL_PLAN_BUF, ZL_PLAN_MAX_XFERS);
+    if (debug > 0)
+        fprintf(stderr, "poll plan: %zu registers in %u transfers, %zu bytes\n",
+                nwatch, plan.nxfer, plan.len);
+
+    if (output) {
+        rc = zl_cap_create(&cap, output, watch, nwatch, chip_id, interval_us);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "create capture %s: %s", output, strerror(-rc));
+    }
+    if (sketch) {
+        char name[ZL_SKETCH_NAME_LEN];
+
+        if (!ntie && !st.adev_mask)
+            errx(EXIT_FAILURE, "--sketch needs --tie or --adev");
+        rc = zl_sketch_create(&st.sk, sketch, chip_id, sketch_s);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "create sketch export %s: %s", sketch, strerror(-rc));
+        for (size_t t = 0; t < ntie; t++) {
+            snprintf(name, sizeof(name), "dpll%u_phase_ns", tie_chan[t]);
+            st.sk_tie[t] = zl_sketch_quantity(&st.sk, name);
+        }
+        for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+            snprintf(name, sizeof(name), "ref%u_ffo_ppb", r);
+            if (st.adev_mask & (1u << r))
+                st.sk_adev[r] = zl_sketch_quantity(&st.sk, name);
+        }
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    static uint8_t payload[ZL_CAP_MAX_WATCH * ZL_WATCH_MAX_LEN];
+    static char line[ZL_SAMPLE_LINE_MAX];
+    struct zl_tie_stats *tie = st.tie;
+    uint8_t refs_last[ZL_NUM_REFS], dplls_last[ZL_MAX_CHANNELS][3];
+    struct zl_jitter jitter;
+    struct timespec next;
+    unsigned long n;
+
+    for (size_t t = 0; t < ntie; t++) {
+        if (zl_tie_init(&tie[t], interval_us / 1e6, tau_max) < 0)
+            errx(EXIT_FAILURE, "cannot set up MTIE/TDEV up to tau %g s", tau_max);
+    }
+    st.ntie = ntie;
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+        if ((st.adev_mask & (1u << r)) &&
+            zl_adev_init(&st.adev[r], interval_us / 1e6, tau_max, 0x1p-32) < 0)
+            errx(EXIT_FAILURE, "cannot set up ADEV up to tau %g s", tau_max);
+    }
+    static struct zl_metrics_snap ms;
+
+    if (metrics) {
+        ms.chip_id = chip_id;
+        ms.nchan = nchan;
+        ms.nphase = ntie;
+        for (size_t t = 0; t < ntie; t++)
+            ms.phase[t].chan = tie_chan[t];
+        ms.alarms = alarms;
+        zl_lat_init(&ms.spi_lat);
+        /* the server thread inherits normal scheduling: start it first */
+        rc = zl_metrics_start(metrics);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "metrics endpoint %s: %s", metrics, strerror(-rc));
+    }
+    uint64_t report_ns = (uint64_t)(report_s * 1e9);
+    uint64_t last_report = zl_now_ns(CLOCK_MONOTONIC);
+
+    if (realtime && zl_rt_enter(cpu, prio) < 0)
+        errx(EXIT_FAILURE, "cannot enter realtime mode (needs CAP_SYS_NICE/CAP_IPC_LOCK)");
+
+    zl_jitter_init(&jitter, (uint64_t)interval_us * 1000);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (n = 0; !stop && (count == 0 || n < count); n++) {
+        zl_jitter_add(&jitter, zl_now_ns(CLOCK_MONOTONIC));
+
+        uint64_t ts = zl_now_ns(CLOCK_REALTIME);
+        uint8_t *p = output ? zl_cap_append(&cap, ts) : payload;
+
+        if (!p)
+            errx(EXIT_FAILURE, "write capture %s failed", output);
+
+        uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+
+        if (zl_plan_submit(fd, &plan) < 0)
+            errx(EXIT_FAILURE, "poll transfer failed");
+        if (metrics)
+            zl_lat_add(&ms.spi_lat, zl_now_ns(CLOCK_MONOTONIC) - t0);
+        for (size_t i = 0; i < nwatch; i++) {
+            memcpy(p, plan.rx + rxoff[i], watch[i].len);
+            p += watch[i].len;
+        }
+
+        if (refs)
+            poll_refs(ts, plan.rx + rxoff[refs_watch], refs_last, n == 0);
+        if (dplls)
+            poll_dplls(ts, plan.rx + rxoff[dpll_watch[0]], plan.rx + rxoff[dpll_watch[1]],
+                       plan.rx + rxoff[dpll_watch[2]], nchan, dplls_last, n == 0);
+        if (alarms)
+            poll_alarms(fd, &st.alarms, plan.rx + rxoff[alarm_watch], ts);
+        if (sketch && zl_sketch_tick(&st.sk, ts) < 0)
+            errx(EXIT_FAILURE, "write sketch export %s failed", sketch);
+        /* phase errors latched by the previous cycle, unless still pending */
+        bool latched = ntie && n > 0 && !plan.rx[latch_rxoff];
+
+        if (ntie && n > 0 && !latched)
+            st.tie_busy++;
+        for (size_t t = 0; t < ntie && n > 0; t++) {
+            int64_t ps = zl_get_s48(plan.rx + rxoff[tie_watch[t]]);
+
+            if (!latched) {
+                zl_tie_gap(&tie[t]);
+                continue;
+            }
+            zl_tie_add(&tie[t], ps);
+            if (metrics)
+                poll_metrics_phase(&ms, t, ps);
+            if (sketch)
+                zl_sketch_add(&st.sk, st.sk_tie[t], ps / 1e3);
+        }
+        if (st.adev_mask) {
+            int64_t ffo[ZL_NUM_REFS];
+            bool idle = !(plan.rx[ctrl_rxoff] & ZL_REF_FREQ_MEAS_CTRL_MASK);
+
+            if (ffo_pending && !idle) {
+                /* no sample this cycle: restart the windows after it */
+                st.adev_busy++;
+                for (unsigned int r = 0; r < ZL_NUM_REFS; r++)
+                    if (st.adev_mask & (1u << r))
+                        zl_adev_gap(&st.adev[r]);
+            } else if (ffo_pending) {
+                ffo_pending = false;
+                zl_be_decode_s(ffo, plan.rx + rxoff[adev_watch], ZL_NUM_REFS,
+                               ZL_REF_FREQ_LEN, ZL_REF_FREQ_LEN);
+                for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+                    if (!(st.adev_mask & (1u << r)))
+                        continue;
+
+                    int64_t y = ffo[r];
+
+                    zl_adev_add(&st.adev[r], y);
+                    if (sketch)
+                        zl_sketch_add(&st.sk, st.sk_adev[r], y * 0x1p-32 * 1e9);
+                }
+            }
+            if (idle) {
+                if (zl_plan_submit(fd, &ffo_trig) < 0)
+                    errx(EXIT_FAILURE, "FFO trigger failed");
+                ffo_pending = true;
+                if (metrics) {
+                    ms.messages++;
+                    ms.transfers += ffo_trig.nxfer;
+                    ms.bytes += ffo_trig.len;
+                }
+            }
+        }
+        if (metrics) {
+            ms.ts_ns = ts;
+            ms.samples = n + 1;
+            ms.late = jitter.late;
+            poll_metrics(&ms, &plan, plan.rx + rxoff[refs_watch], plan.rx + rxoff[dpll_watch[0]],
+                         plan.rx + rxoff[dpll_watch[1]], plan.rx + rxoff[dpll_watch[2]],
+                         alarms ? &st.alarms : NULL);
+        }
+        if ((ntie || st.adev_mask) && report_ns &&
+            zl_now_ns(CLOCK_MONOTONIC) - last_report >= report_ns) {
+            poll_report(&st);
+            last_report = zl_now_ns(CLOCK_MONOTONIC);
+        }
+
+        if (!output && out_format != ZL_FMT_TEXT) {
+            poll_record(ts, watch, nwatch, payload);
+        } else if (!output) {
+            size_t len = zl_format_sample(line, sizeof(line), ts, watch, nwatch, payload);
+            fwrite(line, 1, len, stdout);
+            fflush(stdout);
+        }
+
+        next.tv_nsec += (long)(interval_us % 1000000u) * 1000;
+        next.tv_sec += interval_us / 1000000u + next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        while (!stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+            ;
+    }
+
+    zl_metrics_stop();
+    if (ntie || st.adev_mask)
+        poll_report(&st);
+    for (size_t t = 0; t < ntie; t++)
+        zl_tie_free(&tie[t]);
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+        if (st.adev_mask & (1u << r))
+            zl_adev_free(&st.adev[r]);
+    }
+
+    if (verbose || realtime)
+        zl_jitter_report(&jitter, realtime ? "poll (realtime)" : "poll");
+
+    if (sketch) {
+        rc = zl_sketch_finish(&st.sk);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "close sketch export %s: %s", sketch, strerror(-rc));
+    }
+
+    if (output) {
+        rc = zl_cap_finish(&cap);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "close capture %s: %s", output, strerror(-rc));
+        if (debug > 0)
+            fprintf(stderr, "captured %lu samples (%zu bytes each) to %s\n",
+                    n, payload_len, output);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * SPI mode detection
+ * - The chip ID is read in each SPI mode: the right mode returns the same
+ *   known ID twice, a wrong clock polarity or phase shifts the bits
+ * - The first pass only reads, which finds the ID as long as page 0 is
+ *   selected (as after reset); only when it fails does a second pass
+ *   select page 0 before reading. A write in a wrong mode could land in
+ *   another register of a live device, so the second pass only writes in
+ *   a mode that reads the same valid page back from 0x7F twice
+ * - Slower speeds are tried when no mode answers at the current one
+ * - Results are cached in the state file, so later runs do not probe;
+ *   "probe" checks several device nodes concurrently, one thread each
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+static const uint8_t probe_modes[] = { SPI_MODE_0, SPI_MODE_1, SPI_MODE_2, SPI_MODE_3 };
+static const uint32_t probe_speeds[] = { 1000000, 100000 };
+
+/* Explicit speed per transfer: probes of different nodes run in parallel */
+static int
+probe_xfer(int fd, uint32_t hz, uint8_t *tx, uint8_t *rx, size_t len)
+{
+    struct spi_ioc_transfer xfer = {
+        .tx_buf = (unsigned long)tx,
+        .rx_buf = (unsigned long)rx,
+        .len = (uint32_t)len,
+        .speed_hz = hz,
+        .bits_per_word = bits_per_word,
+    };
+
+    return spi_transfer(fd, &xfer, 1);
+}
+
+/* Page select register read back twice, -ENODEV unless it looks valid */
+static int
+probe_page(int fd, uint32_t hz)
+{
+    uint8_t tx[2] = { 0x80 | ZL_PAGE_SEL }, rx[2][2];
+
+    if (probe_xfer(fd, hz, tx, rx[0], sizeof(tx)) < 0 ||
+        probe_xfer(fd, hz, tx, rx[1], sizeof(tx)) < 0)
+        return -EIO;
+    if (rx[0][1] != rx[1][1] || rx[0][1] >= ZL_NUM_PAGES)
+        return -ENODEV;
+    return rx[0][1];
+}
+
+static int
+probe_id(int fd, uint32_t hz, bool select_page, uint16_t *chip_id)
+{
+    uint8_t tx[3] = { 0x80 | ZL_REG_OFF(ZL_REG_ID) }, rx[2][3];
+    uint8_t page_tx[2] = { ZL_PAGE_SEL, 0 };
+    int page = select_page ? probe_page(fd, hz) : 0;
+
+    if (page < 0)
+        return page;
+    if (page > 0 && probe_xfer(fd, hz, page_tx, NULL, sizeof(page_tx)) < 0)
+        return -EIO;
+    if (probe_xfer(fd, hz, tx, rx[0], sizeof(tx)) < 0 ||
+        probe_xfer(fd, hz, tx, rx[1], sizeof(tx)) < 0)
+        return -EIO;
+
+    *chip_id = (uint16_t)((rx[0][1] << 8) | rx[0][2]);
+    if (memcmp(rx[0] + 1, rx[1] + 1, 2) || !zl_chip_name(*chip_id))
+        return -ENODEV;
+    return 0;
+}
+
+/* Find the SPI mode (and if needed a lower speed) of p->path */
+int
+zl_probe(struct zl_probe *p, uint32_t start_hz)
+{
+    uint32_t speeds[1 + ARRAY_SIZE(probe_speeds)];
+    unsigned int nspeeds = 0;
+    int fd;
+
+    speeds[nspeeds++] = start_hz;
+    for (size_t i = 0; i < ARRAY_SIZE(probe_speeds); i++) {
+        if (probe_speeds[i] < speeds[nspeeds - 1])
+            speeds[nspeeds++] = probe_speeds[i];
+    }
+
+    /* the simulated device answers in any mode */
+    if (zl_sim_path(p->path)) {
+        uint8_t id[2];
+
+        fd = zl_sim_open(p->path);
+        if (fd < 0 || zl_read_reg(fd, ZL_REG_ID, id, sizeof(id)) < 0)
+            return p->rc = -EIO;
+        p->mode = mode;
+        p->speed_hz = start_hz;
+        p->chip_id = (uint16_t)((id[0] << 8) | id[1]);
+        return p->rc = zl_chip_name(p->chip_id) ? 0 : -ENODEV;
+    }
+
+    p->rc = -ENODEV;
+    fd = open(p->path, O_RDWR);
+    if (fd < 0)
+        return p->rc = -errno;
+    if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) == -1) {
+        p->rc = -errno;
+        goto out;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int s = 0; s < nspeeds; s++) {
+            for (size_t m = 0; m < ARRAY_SIZE(probe_modes); m++) {
+                uint8_t md = probe_modes[m];
+
+                if (ioctl(fd, SPI_IOC_WR_MODE, &md) == -1 ||
+                    ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speeds[s]) == -1) {
+                    p->rc = -errno;
+                    goto out;
+                }
+                if (probe_id(fd, speeds[s], pass, &p->chip_id) < 0)
+                    continue;
+                p->mode = md;
+                p->speed_hz = speeds[s];
+                p->rc = 0;
+                goto out;
+            }
+        }
+    }
+out:
+    close(fd);
+    return p->rc;
+}
+
+/* Cache a successful probe; the speed only when it had to be lowered */
+int
+zl_probe_save(const struct zl_probe *p, uint32_t start_hz)
+{
+    char val[16];
+    int rc;
+
+    snprintf(val, sizeof(val), "%u", p->mode & 3);
+    rc = zl_state_set(p->path, "mode", val);
+    if (rc == 0 && p->speed_hz != start_hz) {
+        snprintf(val, sizeof(val), "%u", p->speed_hz);
+        rc = zl_state_set(p->path, "speed_hz", val);
+    }
+    return rc;
+}
+
+static void *
+probe_thread(void *arg)
+{
+    struct zl_probe *p = arg;
+
+    zl_probe(p, speed_hz);
+    return NULL;
+}
+
+static void
+probe_usage(void)
+{
+    fprintf(stderr,
+        "Usage: probe [-n] [DEVNODE]...\n"
+        "  -n  do not save the results to the state file\n"
+        "Detects the SPI mode of each device node (default: the -d one)\n"
+    );
+}
+
+int
+cmd_probe(int fd, int argc, char **argv)
+{
+    bool save = true;
+    int opt, ret = EXIT_SUCCESS;
+
+    (void)fd;
+    optind = 0;
+    while ((opt = getopt(argc, argv, "nh")) != -1) {
+        switch (opt) {
+        case 'n':
+            save = false;
+            break;
+        case 'h':
+        default:
+            probe_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t n = optind < argc ? (size_t)(argc - optind) : 1;
+    struct zl_probe *p = calloc(n, sizeof(*p));
+    pthread_t *tids = calloc(n, sizeof(*tids));
+
+    if (!p || !tids)
+        err(EXIT_FAILURE, "calloc");
+    for (size_t i = 0; i < n; i++) {
+        p[i].path = optind < argc ? argv[optind + i] : devnode;
+        if (pthread_create(&tids[i], NULL, probe_thread, &p[i]))
+            errx(EXIT_FAILURE, "cannot start the probe of %s", p[i].path);
+    }
+
+    printf("%-20s %-4s %-9s %-7s %s\n", "DEVICE", "MODE", "SPEED_HZ", "CHIP_ID", "NAME");
+    for (size_t i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+        if (p[i].rc < 0) {
+            printf("%-20s %s\n", p[i].path,
+                   p[i].rc == -ENODEV ? "no known chip ID in any mode, give it with -m"
+                                      : strerror(-p[i].rc));
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        printf("%-20s %-4u %-9u 0x%04X  %s\n", p[i].path, p[i].mode & 3, p[i].speed_hz,
+               p[i].chip_id, zl_chip_name(p[i].chip_id));
+
+        int rc = save ? zl_probe_save(&p[i], speed_hz) : 0;
+
+        if (rc < 0)
+            warnx("save state %s: %s", state_path, strerror(-rc));
+    }
+
+    free(tids);
+    free(p);
+    return ret;
+}
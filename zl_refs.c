@@ -0,0 +1,108 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Reference monitor sweep
+ * - The status bytes of all references are contiguous on page 2 and are
+ *   read with one page select and one burst
+ * - Bitfields are decoded from a table, shared with poll --refs
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zl3073x.h"
+
+static const struct ref_mon_bit {
+    uint8_t mask;
+    const char *name;
+} ref_mon_bits[] = {
+    { ZL_REF_MON_LOS,   "LOS" },
+    { ZL_REF_MON_SCM,   "SCM" },
+    { ZL_REF_MON_CFM,   "CFM" },
+    { ZL_REF_MON_GST,   "GST" },
+    { ZL_REF_MON_PFM,   "PFM" },
+    { ZL_REF_MON_ESYNC, "ESYNC" },
+};
+
+/* Input pins come in P/N pairs: ref 0 = REF0P, ref 1 = REF0N, ... */
+const char *
+zl_ref_name(unsigned int ref)
+{
+    static const char *const names[ZL_NUM_REFS] = {
+        "REF0P", "REF0N", "REF1P", "REF1N", "REF2P",
+        "REF2N", "REF3P", "REF3N", "REF4P", "REF4N",
+    };
+
+    return ref < ZL_NUM_REFS ? names[ref] : "?";
+}
+
+/* "OK", or the failing monitors as "LOS|SCM"; returns the length */
+size_t
+zl_ref_mon_format(char *buf, size_t size, uint8_t status)
+{
+    size_t n = 0;
+
+    if (!size)
+        return 0;
+    buf[0] = '\0';
+    if (!status)
+        return (size_t)snprintf(buf, size, "OK");
+
+    for (size_t i = 0; i < ARRAY_SIZE(ref_mon_bits) && n < size; i++) {
+        if (status & ref_mon_bits[i].mask)
+            n += (size_t)snprintf(buf + n, size - n, "%s%s", n ? "|" : "",
+                                  ref_mon_bits[i].name);
+    }
+    return n < size ? n : size - 1;
+}
+
+int
+cmd_refs(int fd, int argc, char **argv)
+{
+    uint8_t status[ZL_NUM_REFS];
+
+    optind = 0;
+    if (getopt(argc, argv, "h") != -1 || optind != argc) {
+        fprintf(stderr, "Usage: refs\n"
+                "Prints the monitor status of every input reference (X = flagged)\n");
+        return EXIT_FAILURE;
+    }
+
+    if (zl_read_reg(fd, ZL_REG_REF_MON_STATUS(0), status, sizeof(status)) < 0)
+        errx(EXIT_FAILURE, "read ZL_REG_REF_MON_STATUS failed");
+
+    if (out_format != ZL_FMT_TEXT) {
+        static struct zl_rec rec;
+        char flags[64];
+
+        for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+            zl_ref_mon_format(flags, sizeof(flags), status[r]);
+            zl_rec_begin(&rec);
+            zl_rec_str(&rec, "ref", zl_ref_name(r));
+            zl_rec_hex(&rec, "status", status[r], 1);
+            zl_rec_str(&rec, "flags", flags);
+            for (size_t b = 0; b < ARRAY_SIZE(ref_mon_bits); b++)
+                zl_rec_bool(&rec, ref_mon_bits[b].name, status[r] & ref_mon_bits[b].mask);
+            if (zl_rec_end(&rec) < 0)
+                errx(EXIT_FAILURE, "write reference record failed");
+        }
+        return EXIT_SUCCESS;
+    }
+
+    printf("%-6s %-6s", "REF", "STATUS");
+    for (size_t b = 0; b < ARRAY_SIZE(ref_mon_bits); b++)
+        printf(" %-5s", ref_mon_bits[b].name);
+    printf("\n");
+
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+        printf("%-6s 0x%02X  ", zl_ref_name(r), status[r]);
+        for (size_t b = 0; b < ARRAY_SIZE(ref_mon_bits); b++)
+            printf(" %-5s", (status[r] & ref_mon_bits[b].mask) ? "X" : "-");
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
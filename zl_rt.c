@@ -0,0 +1,225 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Real-time polling support
+ * - Lock all current and future pages, fault in the stack and the SPI
+ *   transfer buffers, pin the calling thread, switch it to SCHED_FIFO
+ * - Account the achieved sample intervals so the effect can be measured
+ * - Latency histograms for timed bus operations
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "zl3073x.h"
+
+/* Stack depth faulted in up front; well above what the polling loop uses */
+#define ZL_RT_STACK_PREFAULT (256 * 1024)
+
+static void
+prefault_stack(void)
+{
+    volatile uint8_t stack[ZL_RT_STACK_PREFAULT];
+
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+/* cpu < 0 leaves the affinity alone; prio 0 keeps the current policy */
+int
+zl_rt_enter(int cpu, int prio)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        warn("mlockall");
+        return -errno;
+    }
+
+    prefault_stack();
+    spi_prefault();
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        int rc;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc) {
+            warnx("pin to CPU %d: %s", cpu, strerror(rc));
+            return -rc;
+        }
+    }
+
+    if (prio > 0) {
+        struct sched_param sp = { .sched_priority = prio };
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (rc) {
+            warnx("SCHED_FIFO priority %d: %s", prio, strerror(rc));
+            return -rc;
+        }
+    }
+
+    if (debug > 0)
+        fprintf(stderr, "realtime: memory locked, cpu %d, SCHED_FIFO %d\n", cpu, prio);
+
+    return 0;
+}
+
+uint64_t
+zl_now_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void
+zl_jitter_init(struct zl_jitter *j, uint64_t interval_ns)
+{
+    memset(j, 0, sizeof(*j));
+    j->interval_ns = interval_ns;
+    j->min_ns = INT64_MAX;
+    j->max_ns = INT64_MIN;
+}
+
+/* Feed the CLOCK_MONOTONIC start time of each sample */
+void
+zl_jitter_add(struct zl_jitter *j, uint64_t t_ns)
+{
+    uint64_t last = j->last_ns;
+
+    j->last_ns = t_ns;
+    if (!last)
+        return;
+
+    uint64_t dt = t_ns - last;
+    int64_t dev = (int64_t)(dt - j->interval_ns);
+    double delta = (double)dev - j->mean_ns;
+
+    j->n++;
+    j->mean_ns += delta / (double)j->n;
+    j->m2 += delta * ((double)dev - j->mean_ns);
+    if (dev < j->min_ns)
+        j->min_ns = dev;
+    if (dev > j->max_ns)
+        j->max_ns = dev;
+    if (2 * dt > 3 * j->interval_ns)
+        j->late++;
+}
+
+void
+zl_jitter_report(const struct zl_jitter *j, const char *what)
+{
+    if (!j->n) {
+        fprintf(stderr, "%s: not enough samples for jitter\n", what);
+        return;
+    }
+
+    fprintf(stderr,
+            "%s: %llu intervals of %.3f us, deviation min %+.3f max %+.3f "
+            "mean %+.3f stddev %.3f us, %llu late (>1.5x)\n",
+            what, (unsigned long long)j->n, j->interval_ns / 1e3,
+            j->min_ns / 1e3, j->max_ns / 1e3, j->mean_ns / 1e3,
+            sqrt(j->m2 / (double)j->n) / 1e3, (unsigned long long)j->late);
+}
+
+static unsigned int
+lat_bucket(uint64_t ns)
+{
+    if (ns < 8)
+        return (unsigned int)ns;
+
+    unsigned int msb = 63 - (unsigned int)__builtin_clzll(ns);
+    unsigned int idx = msb * 8 + (unsigned int)((ns >> (msb - 3)) & 7);
+
+    return idx < ZL_LAT_BUCKETS ? idx : ZL_LAT_BUCKETS - 1;
+}
+
+/* Upper bound of the values counted in bucket idx */
+static uint64_t
+lat_bucket_max(unsigned int idx)
+{
+    if (idx < 8)
+        return idx;
+
+    unsigned int msb = idx / 8;
+
+    return ((uint64_t)(8 + idx % 8 + 1) << (msb - 3)) - 1;
+}
+
+void
+zl_lat_init(struct zl_lat *l)
+{
+    memset(l, 0, sizeof(*l));
+    l->min_ns = UINT64_MAX;
+}
+
+void
+zl_lat_add(struct zl_lat *l, uint64_t ns)
+{
+    l->n++;
+    l->sum_ns += ns;
+    if (ns < l->min_ns)
+        l->min_ns = ns;
+    if (ns > l->max_ns)
+        l->max_ns = ns;
+    l->bucket[lat_bucket(ns)]++;
+}
+
+/* Approximate quantile (within 1/8 of a power of two), 0 <= q <= 1 */
+uint64_t
+zl_lat_quantile(const struct zl_lat *l, double q)
+{
+    uint64_t rank = (uint64_t)(q * (double)l->n), seen = 0;
+
+    if (!l->n)
+        return 0;
+    if (rank >= l->n)
+        rank = l->n - 1;
+
+    for (unsigned int i = 0; i < ZL_LAT_BUCKETS; i++) {
+        seen += l->bucket[i];
+        if (seen > rank) {
+            uint64_t v = lat_bucket_max(i);
+            return v > l->max_ns ? l->max_ns : v;
+        }
+    }
+    return l->max_ns;
+}
+
+/* Samples below 2^log2_ns ns, exact at these bounds */
+uint64_t
+zl_lat_below(const struct zl_lat *l, unsigned int log2_ns)
+{
+    unsigned int end = log2_ns < 3 ? (1u << log2_ns) : 8 * log2_ns;
+    uint64_t n = 0;
+
+    for (unsigned int i = 0; i < end && i < ZL_LAT_BUCKETS; i++)
+        n += l->bucket[i];
+    return n;
+}
+
+void
+zl_lat_report(const struct zl_lat *l, const char *what)
+{
+    if (!l->n) {
+        fprintf(stderr, "%s: no samples\n", what);
+        return;
+    }
+
+    fprintf(stderr,
+            "%s: n=%llu min %.1f mean %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f us\n",
+            what, (unsigned long long)l->n, l->min_ns / 1e3,
+            (double)l->sum_ns / (double)l->n / 1e3,
+            zl_lat_quantile(l, 0.5) / 1e3, zl_lat_quantile(l, 0.99) / 1e3,
+            zl_lat_quantile(l, 0.999) / 1e3, l->max_ns / 1e3);
+}
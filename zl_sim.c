@@ -0,0 +1,206 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Simulated register backend, selected with -d sim[:CHIP_ID]
+ * - spi_transfer() hands the messages of the simulated device node here;
+ *   every command then runs unchanged without hardware
+ * - Registers are a plain page array with the side effects the tool
+ *   relies on: page select, mailbox load/store completing at once,
+ *   write-1-to-clear sticky alarms, FFO measurement and phase error
+ *   latching
+ * - Each message advances the model: phase errors and FFOs random-walk,
+ *   and now and then a reference or DPLL alarm latches
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+#define SIM_ALARM_PERIOD  4096  /* messages between latched alarms, on average */
+
+static struct {
+    int fd;
+    uint8_t page;
+    uint32_t seed;
+    int64_t phase[ZL_MAX_CHANNELS];
+    uint8_t regs[ZL_NUM_PAGES][ZL_PAGE_SIZE];
+    uint8_t mb[ZL_MB_NTYPES][ZL_MB_MAX_OBJS][ZL_MB_DATA_LEN];
+} sim = { .fd = -1 };
+
+static uint32_t
+sim_rand(void)
+{
+    sim.seed ^= sim.seed << 13;
+    sim.seed ^= sim.seed >> 17;
+    sim.seed ^= sim.seed << 5;
+    return sim.seed;
+}
+
+static void
+sim_put_be(uint8_t *p, uint64_t v, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        p[i] = (uint8_t)(v >> (8 * (len - 1 - i)));
+}
+
+bool
+zl_sim_path(const char *path)
+{
+    return !strncmp(path, "sim", 3) && (path[3] == '\0' || path[3] == ':');
+}
+
+/* "sim" or "sim:0x0E96"; returns a descriptor that only identifies it */
+int
+zl_sim_open(const char *path)
+{
+    uint16_t chip_id = path[3] == ':' ? (uint16_t)strtoul(path + 4, NULL, 0) : 0x0E95;
+    const struct zl_chip *c = zl_chip_caps(chip_id);
+
+    if (sim.fd < 0) {
+        sim.fd = open("/dev/null", O_RDWR);
+        if (sim.fd < 0)
+            return -errno;
+    }
+
+    memset(sim.regs, 0, sizeof(sim.regs));
+    sim.page = 0;
+    sim.seed = 0x9E3779B9u ^ chip_id;
+    sim_put_be(&sim.regs[0][ZL_REG_OFF(ZL_REG_ID)], chip_id, 2);
+    sim.regs[0][ZL_REG_OFF(ZL_REG_REVISION)] = 0x03;
+    sim_put_be(&sim.regs[0][ZL_REG_OFF(ZL_REG_FW_VER)], 0x178A, 2);
+    sim_put_be(&sim.regs[0][ZL_REG_OFF(ZL_REG_CUSTOM_CONFIG_VER)], 0xFFFFFFFF, 4);
+
+    for (unsigned int ch = 0; ch < c->channels; ch++) {
+        sim.regs[2][ZL_REG_OFF(ZL_REG_DPLL_MON_STATUS(ch))] = ZL_DPLL_MON_STATE_LOCK |
+                                                              ZL_DPLL_MON_HO_READY;
+        sim.regs[2][ZL_REG_OFF(ZL_REG_DPLL_REFSEL_STATUS(ch))] =
+            (uint8_t)((4 << ZL_DPLL_REFSEL_STATE_SHIFT) | (2 * ch));
+        sim.regs[5][ZL_REG_OFF(ZL_REG_DPLL_MODE_REFSEL(ch))] = ZL_DPLL_MODE_AUTO;
+    }
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        for (unsigned int i = 0; i < ZL_MB_MAX_OBJS; i++) {
+            for (unsigned int k = 0; k < ZL_MB_DATA_LEN; k++)
+                sim.mb[t][i][k] = (uint8_t)(t * 16 + i + k * 7);
+        }
+    }
+
+    return sim.fd;
+}
+
+bool
+zl_sim_fd(int fd)
+{
+    return fd >= 0 && fd == sim.fd;
+}
+
+/* Mailbox type of a page, -1 if none */
+static int
+sim_mb_type(uint8_t page)
+{
+    for (unsigned int t = 0; t < ZL_MB_NTYPES; t++) {
+        if (zl_mb_page(t) == page)
+            return (int)t;
+    }
+    return -1;
+}
+
+static void
+sim_mb_op(uint8_t page, uint8_t op)
+{
+    uint8_t *r = sim.regs[page];
+    unsigned int mask = (unsigned int)(r[ZL_MB_MASK] << 8 | r[ZL_MB_MASK + 1]);
+    unsigned int idx = mask ? (unsigned int)__builtin_ctz(mask) : 0;
+    int t = sim_mb_type(page);
+
+    if (t >= 0 && idx < ZL_MB_MAX_OBJS) {
+        if (op & ZL_MB_SEM_RD)
+            memcpy(&r[ZL_MB_DATA], sim.mb[t][idx], ZL_MB_DATA_LEN);
+        else if (op & ZL_MB_SEM_WR)
+            memcpy(sim.mb[t][idx], &r[ZL_MB_DATA], ZL_MB_DATA_LEN);
+    }
+    r[ZL_MB_SEM] = 0;
+}
+
+static void
+sim_write(uint8_t off, uint8_t v)
+{
+    uint16_t reg = ZL_REG(sim.page, off);
+
+    if (off == ZL_PAGE_SEL) {
+        sim.page = v & 0x0F;
+        return;
+    }
+    if (reg >= ZL_REG_REF_MON_STICKY(0) && reg <= ZL_REG_DPLL_STICKY(ZL_MAX_CHANNELS - 1)) {
+        sim.regs[sim.page][off] &= (uint8_t)~v;
+        return;
+    }
+
+    sim.regs[sim.page][off] = v;
+    if (off == ZL_MB_SEM && sim_mb_type(sim.page) >= 0)
+        sim_mb_op(sim.page, v);
+    else if (reg == ZL_REG_REF_FREQ_MEAS_CTRL)
+        sim.regs[sim.page][off] = 0;
+    else if (reg == ZL_REG_DPLL_PHASE_ERR_READ_MASK) {
+        for (unsigned int ch = 0; ch < ZL_MAX_CHANNELS; ch++) {
+            if (v & (1u << ch))
+                sim_put_be(&sim.regs[5][ZL_REG_OFF(ZL_REG_DPLL_PHASE_ERR_DATA(ch))],
+                           (uint64_t)sim.phase[ch], ZL_DPLL_PHASE_ERR_LEN);
+        }
+        sim.regs[sim.page][off] = 0;
+    }
+}
+
+/* Advance the model by one message */
+static void
+sim_tick(void)
+{
+    for (unsigned int ch = 0; ch < ZL_MAX_CHANNELS; ch++)
+        sim.phase[ch] += (int64_t)(sim_rand() % 201) - 100;
+    for (unsigned int r = 0; r < ZL_NUM_REFS; r++) {
+        int32_t ffo = (int32_t)(sim_rand() % 2001) - 1000 + 100 * (int32_t)r;
+
+        sim_put_be(&sim.regs[2][ZL_REG_OFF(ZL_REG_REF_FREQ(r))], (uint32_t)ffo, ZL_REF_FREQ_LEN);
+    }
+    if (sim_rand() % SIM_ALARM_PERIOD == 0) {
+        unsigned int i = sim_rand() % (ZL_NUM_REFS + ZL_MAX_CHANNELS);
+
+        sim.regs[2][ZL_REG_OFF(ZL_REG_REF_MON_STICKY(i))] |= (uint8_t)(1u << (sim_rand() % 3));
+    }
+}
+
+int
+zl_sim_transfer(const struct spi_ioc_transfer *xfer, unsigned int n)
+{
+    sim_tick();
+    for (unsigned int i = 0; i < n; i++) {
+        const uint8_t *tx = (const uint8_t *)(uintptr_t)xfer[i].tx_buf;
+        uint8_t *rx = (uint8_t *)(uintptr_t)xfer[i].rx_buf;
+        uint32_t len = xfer[i].len;
+
+        if (!tx || !len)
+            continue;
+
+        uint8_t off = tx[0] & 0x7F;
+
+        if (tx[0] & 0x80) {
+            if (!rx)
+                continue;
+            rx[0] = 0;
+            for (uint32_t k = 1; k < len; k++) {
+                uint8_t a = (uint8_t)((off + k - 1) & 0x7F);
+
+                rx[k] = a == ZL_PAGE_SEL ? sim.page : sim.regs[sim.page][a];
+            }
+        } else {
+            for (uint32_t k = 1; k < len; k++)
+                sim_write((uint8_t)((off + k - 1) & 0x7F), tx[k]);
+        }
+    }
+    return 0;
+}
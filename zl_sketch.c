@@ -0,0 +1,498 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Quantile sketches (see zl_sketch.h)
+ * - Merging t-digest with the k1 (arcsine) scale function: samples are
+ *   buffered, then sorted together with the centroids and greedily merged
+ *   while a centroid stays within one unit of k, which keeps the tails
+ *   (p99.9) accurate with a few hundred centroids
+ * - Merging two digests is adding the centroids of one to the other, so
+ *   per-chip, per-interval exports can be aggregated without raw samples
+ * - "sketch" merges exported files, overall or per interval
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zl3073x.h"
+#include "zl_capture.h"
+#include "zl_sketch.h"
+
+void
+zl_td_init(struct zl_tdigest *t)
+{
+    t->ncent = t->nbuf = 0;
+    t->total = 0;
+    t->min = INFINITY;
+    t->max = -INFINITY;
+}
+
+void
+zl_td_add(struct zl_tdigest *t, double x, double w)
+{
+    if (x < t->min)
+        t->min = x;
+    if (x > t->max)
+        t->max = x;
+    t->buf[t->nbuf].mean = x;
+    t->buf[t->nbuf].weight = w;
+    if (++t->nbuf == ZL_TD_BUF)
+        zl_td_compress(t);
+}
+
+static int
+cent_cmp(const void *a, const void *b)
+{
+    double x = ((const struct zl_centroid *)a)->mean;
+    double y = ((const struct zl_centroid *)b)->mean;
+
+    return (x > y) - (x < y);
+}
+
+/* k1 scale function and its inverse, k in [-delta/4, delta/4] */
+static double
+td_k(double q)
+{
+    return ZL_TD_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+static double
+td_q(double k)
+{
+    if (k >= ZL_TD_COMPRESSION / 4.0)
+        return 1;
+    return (sin(k * 2 * M_PI / ZL_TD_COMPRESSION) + 1) / 2;
+}
+
+void
+zl_td_compress(struct zl_tdigest *t)
+{
+    static __thread struct zl_centroid all[ZL_TD_MAX_CENT + ZL_TD_BUF];
+    uint32_t n = t->ncent + t->nbuf;
+    double total = t->total;
+
+    if (!t->nbuf)
+        return;
+
+    memcpy(all, t->cent, t->ncent * sizeof(*all));
+    memcpy(all + t->ncent, t->buf, t->nbuf * sizeof(*all));
+    for (uint32_t i = 0; i < t->nbuf; i++)
+        total += t->buf[i].weight;
+    qsort(all, n, sizeof(*all), cent_cmp);
+
+    struct zl_centroid cur = all[0];
+    double sofar = 0, limit = td_q(td_k(0) + 1) * total;
+    uint32_t out = 0;
+
+    for (uint32_t i = 1; i < n; i++) {
+        double w = cur.weight + all[i].weight;
+
+        if (sofar + w <= limit || out == ZL_TD_MAX_CENT - 1) {
+            cur.mean += (all[i].mean - cur.mean) * all[i].weight / w;
+            cur.weight = w;
+            continue;
+        }
+        t->cent[out++] = cur;
+        sofar += cur.weight;
+        limit = td_q(td_k(sofar / total) + 1) * total;
+        cur = all[i];
+    }
+    t->cent[out++] = cur;
+
+    t->ncent = out;
+    t->nbuf = 0;
+    t->total = total;
+}
+
+void
+zl_td_merge(struct zl_tdigest *dst, const struct zl_tdigest *src)
+{
+    for (uint32_t i = 0; i < src->ncent; i++)
+        zl_td_add(dst, src->cent[i].mean, src->cent[i].weight);
+    for (uint32_t i = 0; i < src->nbuf; i++)
+        zl_td_add(dst, src->buf[i].mean, src->buf[i].weight);
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t
+zl_td_count(const struct zl_tdigest *t)
+{
+    double w = t->total;
+
+    for (uint32_t i = 0; i < t->nbuf; i++)
+        w += t->buf[i].weight;
+    return (uint64_t)nearbyint(w);
+}
+
+/* Interpolates between centroid centers, and towards min/max in the tails */
+double
+zl_td_quantile(struct zl_tdigest *t, double q)
+{
+    zl_td_compress(t);
+    if (!t->ncent)
+        return NAN;
+    if (q <= 0)
+        return t->min;
+    if (q >= 1)
+        return t->max;
+
+    const struct zl_centroid *c = t->cent;
+    uint32_t n = t->ncent;
+    double target = q * t->total;
+
+    if (n == 1)
+        return t->min + q * (t->max - t->min);
+    if (target < c[0].weight / 2)
+        return t->min + (c[0].mean - t->min) * target / (c[0].weight / 2);
+
+    double cum = 0;
+
+    for (uint32_t i = 0; i + 1 < n; i++) {
+        double ci = cum + c[i].weight / 2;
+        double cn = cum + c[i].weight + c[i + 1].weight / 2;
+
+        if (target < cn)
+            return c[i].mean + (c[i + 1].mean - c[i].mean) * (target - ci) / (cn - ci);
+        cum += c[i].weight;
+    }
+
+    double cl = t->total - c[n - 1].weight / 2;
+    double v = c[n - 1].mean + (t->max - c[n - 1].mean) * (target - cl) / (c[n - 1].weight / 2);
+
+    return v < t->max ? v : t->max;
+}
+
+static uint64_t
+dbl_to_le(double d)
+{
+    uint64_t u;
+
+    memcpy(&u, &d, sizeof(u));
+    return htole64(u);
+}
+
+static double
+dbl_from_le(uint64_t u)
+{
+    double d;
+
+    u = le64toh(u);
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+int
+zl_sketch_create(struct zl_sketch_writer *w, const char *path,
+                 uint16_t chip_id, uint32_t interval_s)
+{
+    struct zl_sketch_file_hdr hdr;
+
+    memset(w, 0, sizeof(*w));
+    if (!interval_s)
+        return -EINVAL;
+    w->interval_ns = (uint64_t)interval_s * 1000000000u;
+    w->td = calloc(ZL_SKETCH_MAX_QTY, sizeof(*w->td));
+    if (!w->td)
+        return -ENOMEM;
+
+    w->f = fopen(path, "wb");
+    if (!w->f) {
+        int rc = -errno;
+        free(w->td);
+        return rc;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ZL_SKETCH_MAGIC, sizeof(hdr.magic));
+    hdr.version = htole32(ZL_SKETCH_VERSION);
+    hdr.compression = htole32(ZL_TD_COMPRESSION);
+    hdr.chip_id = htole16(chip_id);
+    hdr.interval_s = htole32(interval_s);
+    snprintf(hdr.devnode, sizeof(hdr.devnode), "%s", devnode);
+
+    if (fwrite(&hdr, sizeof(hdr), 1, w->f) != 1 || fflush(w->f)) {
+        int rc = -errno;
+        fclose(w->f);
+        free(w->td);
+        return rc;
+    }
+    return 0;
+}
+
+/* Register a quantity; returns its index */
+int
+zl_sketch_quantity(struct zl_sketch_writer *w, const char *name)
+{
+    if (w->nqty == ZL_SKETCH_MAX_QTY)
+        return -ENOSPC;
+    snprintf(w->name[w->nqty], ZL_SKETCH_NAME_LEN, "%s", name);
+    zl_td_init(&w->td[w->nqty]);
+    return (int)w->nqty++;
+}
+
+/* Write the sketches of the current interval and start over */
+static int
+sketch_emit(struct zl_sketch_writer *w)
+{
+    for (unsigned int q = 0; q < w->nqty; q++) {
+        struct zl_tdigest *t = &w->td[q];
+        struct zl_sketch_rec_hdr rh;
+
+        zl_td_compress(t);
+        if (!t->ncent)
+            continue;
+
+        memset(&rh, 0, sizeof(rh));
+        rh.magic = htole32(ZL_SKETCH_REC_MAGIC);
+        rh.ncent = htole32(t->ncent);
+        rh.start_ns = htole64(w->start_ns);
+        rh.end_ns = htole64(w->end_ns);
+        rh.min = dbl_to_le(t->min);
+        rh.max = dbl_to_le(t->max);
+        memcpy(rh.name, w->name[q], sizeof(rh.name));
+        fwrite(&rh, sizeof(rh), 1, w->f);
+
+        for (uint32_t i = 0; i < t->ncent; i++) {
+            uint64_t c[2] = { dbl_to_le(t->cent[i].mean), dbl_to_le(t->cent[i].weight) };
+            fwrite(c, sizeof(c), 1, w->f);
+        }
+        zl_td_init(t);
+    }
+
+    return (fflush(w->f) || ferror(w->f)) ? -EIO : 0;
+}
+
+/* Start of a sample at ts_ns: exports the previous interval once it ended */
+int
+zl_sketch_tick(struct zl_sketch_writer *w, uint64_t ts_ns)
+{
+    int rc = 0;
+
+    if (w->end_ns && ts_ns < w->end_ns)
+        return 0;
+    if (w->end_ns)
+        rc = sketch_emit(w);
+    w->start_ns = ts_ns - ts_ns % w->interval_ns;
+    w->end_ns = w->start_ns + w->interval_ns;
+
+    return rc;
+}
+
+void
+zl_sketch_add(struct zl_sketch_writer *w, int qty, double v)
+{
+    zl_td_add(&w->td[qty], v, 1);
+}
+
+int
+zl_sketch_finish(struct zl_sketch_writer *w)
+{
+    int rc = w->end_ns ? sketch_emit(w) : 0;
+
+    if (fclose(w->f) && !rc)
+        rc = -errno;
+    free(w->td);
+    w->td = NULL;
+
+    return rc;
+}
+
+/* Offline merge of exported sketches */
+
+struct sketch_group {
+    uint64_t start_ns;
+    char name[ZL_SKETCH_NAME_LEN];
+    struct zl_tdigest *td;
+};
+
+struct sketch_merge {
+    bool by_interval;
+    uint64_t from, to;
+    size_t ngroup, cap;
+    struct sketch_group *group;
+};
+
+static struct zl_tdigest *
+merge_group(struct sketch_merge *m, uint64_t start_ns, const char *name)
+{
+    if (!m->by_interval)
+        start_ns = 0;
+
+    /* records arrive mostly in order: look from the most recent group */
+    for (size_t i = m->ngroup; i-- > 0;) {
+        if (m->group[i].start_ns == start_ns && !strcmp(m->group[i].name, name))
+            return m->group[i].td;
+    }
+
+    if (m->ngroup == m->cap) {
+        size_t cap = m->cap ? 2 * m->cap : 64;
+        struct sketch_group *g = realloc(m->group, cap * sizeof(*g));
+
+        if (!g)
+            return NULL;
+        m->group = g;
+        m->cap = cap;
+    }
+
+    struct sketch_group *g = &m->group[m->ngroup];
+
+    g->td = malloc(sizeof(*g->td));
+    if (!g->td)
+        return NULL;
+    zl_td_init(g->td);
+    g->start_ns = start_ns;
+    memcpy(g->name, name, sizeof(g->name));
+    m->ngroup++;
+
+    return g->td;
+}
+
+/* Each record is loaded as a digest of its own, then merged into its group */
+static int
+merge_file(struct sketch_merge *m, const char *path)
+{
+    static struct zl_tdigest rec;
+    struct zl_sketch_file_hdr hdr;
+    struct zl_sketch_rec_hdr rh;
+    FILE *f = fopen(path, "rb");
+    int rc = 0;
+
+    if (!f)
+        return -errno;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, ZL_SKETCH_MAGIC, sizeof(hdr.magic)) ||
+        le32toh(hdr.version) != ZL_SKETCH_VERSION) {
+        fclose(f);
+        return -EINVAL;
+    }
+
+    while (fread(&rh, sizeof(rh), 1, f) == 1) {
+        uint32_t ncent = le32toh(rh.ncent);
+        uint64_t start = le64toh(rh.start_ns), end = le64toh(rh.end_ns);
+        bool keep = end > m->from && start <= m->to;
+        struct zl_tdigest *t = NULL;
+
+        /* a torn last record (crash while exporting) ends the file */
+        if (le32toh(rh.magic) != ZL_SKETCH_REC_MAGIC || ncent > ZL_TD_MAX_CENT)
+            break;
+        rh.name[sizeof(rh.name) - 1] = '\0';
+        if (keep && !(t = merge_group(m, start, rh.name))) {
+            rc = -ENOMEM;
+            break;
+        }
+
+        uint32_t i;
+
+        zl_td_init(&rec);
+        for (i = 0; i < ncent; i++) {
+            uint64_t c[2];
+
+            if (fread(c, sizeof(c), 1, f) != 1)
+                break;
+            rec.cent[i].mean = dbl_from_le(c[0]);
+            rec.cent[i].weight = dbl_from_le(c[1]);
+            rec.total += rec.cent[i].weight;
+        }
+        if (i < ncent)
+            break;
+        rec.ncent = ncent;
+        rec.min = dbl_from_le(rh.min);
+        rec.max = dbl_from_le(rh.max);
+        if (t)
+            zl_td_merge(t, &rec);
+    }
+
+    fclose(f);
+    return rc;
+}
+
+static void
+sketch_usage(void)
+{
+    fprintf(stderr,
+        "Usage: sketch [-f from] [-t to] [-b] FILE...\n"
+        "  -f  first interval to include (epoch s, UTC ISO-8601 or +S)\n"
+        "  -t  last interval to include\n"
+        "  -b  one result per interval instead of the whole range\n"
+        "Merges sketch exports (poll --sketch) and prints quantiles\n"
+    );
+}
+
+int
+cmd_sketch(int fd, int argc, char **argv)
+{
+    struct sketch_merge m = { .to = UINT64_MAX };
+    const char *from = NULL, *to = NULL;
+    int opt, rc;
+
+    (void)fd;
+    optind = 0;
+    while ((opt = getopt(argc, argv, "f:t:bh")) != -1) {
+        switch (opt) {
+        case 'f':
+            from = optarg;
+            break;
+        case 't':
+            to = optarg;
+            break;
+        case 'b':
+            m.by_interval = true;
+            break;
+        case 'h':
+        default:
+            sketch_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc) {
+        sketch_usage();
+        return EXIT_FAILURE;
+    }
+    if (from && zl_parse_time(from, 0, &m.from) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", from);
+    if (to && zl_parse_time(to, m.from, &m.to) < 0)
+        errx(EXIT_FAILURE, "invalid time '%s'", to);
+
+    for (int i = optind; i < argc; i++) {
+        rc = merge_file(&m, argv[i]);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "%s: %s", argv[i], strerror(-rc));
+    }
+
+    if (m.by_interval)
+        printf("%-21s", "# interval");
+    printf("%-21s %10s %14s %14s %14s %14s %14s\n", m.by_interval ? "quantity" : "# quantity",
+           "n", "min", "p50", "p99", "p99.9", "max");
+    for (size_t i = 0; i < m.ngroup; i++) {
+        struct sketch_group *g = &m.group[i];
+
+        if (m.by_interval) {
+            time_t sec = (time_t)(g->start_ns / 1000000000u);
+            struct tm tm;
+            char ts[32];
+
+            gmtime_r(&sec, &tm);
+            strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+            printf("%s ", ts);
+        }
+        printf("%-21s %10llu %14.6g %14.6g %14.6g %14.6g %14.6g\n", g->name,
+               (unsigned long long)zl_td_count(g->td), g->td->min,
+               zl_td_quantile(g->td, 0.5), zl_td_quantile(g->td, 0.99),
+               zl_td_quantile(g->td, 0.999), g->td->max);
+        free(g->td);
+    }
+    free(m.group);
+
+    return EXIT_SUCCESS;
+}
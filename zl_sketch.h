@@ -0,0 +1,91 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Mergeable quantile sketches (merging t-digest) and the sketch export
+ * files written by the polling mode
+ *
+ * Layout (all fields little-endian, doubles IEEE 754):
+ * * File header (struct zl_sketch_file_hdr)
+ * * Per interval and quantity, a record header followed by ncent
+ *   (mean, weight) centroid pairs
+ *
+ * Intervals are aligned on multiples of their length in CLOCK_REALTIME,
+ * so sketches exported by different chips for the same minute share the
+ * same start time and can be merged centrally.
+ */
+
+#ifndef ZL_SKETCH_H
+#define ZL_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define ZL_TD_COMPRESSION   200
+#define ZL_TD_MAX_CENT      (2 * ZL_TD_COMPRESSION)
+#define ZL_TD_BUF           512
+
+#define ZL_SKETCH_MAGIC      "ZLSKT\r\n\032"
+#define ZL_SKETCH_VERSION    1
+#define ZL_SKETCH_REC_MAGIC  0x52534C5A  // "ZLSR"
+#define ZL_SKETCH_NAME_LEN   24
+#define ZL_SKETCH_MAX_QTY    16
+
+struct zl_centroid {
+    double mean;
+    double weight;
+};
+
+struct zl_tdigest {
+    uint32_t ncent, nbuf;
+    double total;           /* weight of the centroids */
+    double min, max;
+    struct zl_centroid cent[ZL_TD_MAX_CENT];
+    struct zl_centroid buf[ZL_TD_BUF];
+};
+
+void zl_td_init(struct zl_tdigest *t);
+void zl_td_add(struct zl_tdigest *t, double x, double w);
+void zl_td_compress(struct zl_tdigest *t);
+void zl_td_merge(struct zl_tdigest *dst, const struct zl_tdigest *src);
+uint64_t zl_td_count(const struct zl_tdigest *t);
+double zl_td_quantile(struct zl_tdigest *t, double q);
+
+struct zl_sketch_file_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t compression;
+    uint16_t chip_id;
+    uint16_t pad;
+    uint32_t interval_s;
+    char devnode[64];
+};
+
+struct zl_sketch_rec_hdr {
+    uint32_t magic;
+    uint32_t ncent;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t min;           /* double bits */
+    uint64_t max;           /* double bits */
+    char name[ZL_SKETCH_NAME_LEN];
+};
+
+/* Per-interval export of one sketch per quantity */
+struct zl_sketch_writer {
+    FILE *f;
+    uint64_t interval_ns;
+    uint64_t start_ns, end_ns;
+    unsigned int nqty;
+    char name[ZL_SKETCH_MAX_QTY][ZL_SKETCH_NAME_LEN];
+    struct zl_tdigest *td;
+};
+
+int zl_sketch_create(struct zl_sketch_writer *w, const char *path,
+                     uint16_t chip_id, uint32_t interval_s);
+int zl_sketch_quantity(struct zl_sketch_writer *w, const char *name);
+int zl_sketch_tick(struct zl_sketch_writer *w, uint64_t ts_ns);
+void zl_sketch_add(struct zl_sketch_writer *w, int qty, double v);
+int zl_sketch_finish(struct zl_sketch_writer *w);
+
+#endif /* ZL_SKETCH_H */
@@ -0,0 +1,334 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Full register image and change detection
+ * - All 16 pages (without their page select byte) are read in one SPI
+ *   message planned once; the image is indexed by register address
+ * - The previous image is kept and the new one compared 16 bytes at a
+ *   time (SSE2 on x86, NEON on AArch64, two 64-bit words otherwise):
+ *   equal blocks cost one compare, and only blocks that differ are
+ *   scanned byte by byte for the changed ranges
+ * - Each changed range is printed with the known registers it overlaps;
+ *   the page select bytes are never read, so ranges never span pages
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "zl3073x.h"
+
+/* Annotated registers: count fields of len bytes, stride apart */
+static const struct {
+    uint16_t reg;
+    uint8_t len, count, stride;
+    const char *name;
+} snap_regs[] = {
+    { ZL_REG_ID,                       2, 1, 0, "chip_id" },
+    { ZL_REG_REVISION,                 1, 1, 0, "revision" },
+    { ZL_REG_FW_VER,                   2, 1, 0, "fw_ver" },
+    { ZL_REG_CUSTOM_CONFIG_VER,        4, 1, 0, "custom_config_ver" },
+    { ZL_REG_REF_MON_STATUS(0),        1, ZL_NUM_REFS, 1, "ref_mon_status" },
+    { ZL_REG_DPLL_MON_STATUS(0),       1, ZL_MAX_CHANNELS, 1, "dpll_mon_status" },
+    { ZL_REG_REF_MON_STICKY(0),        1, ZL_NUM_REFS, 1, "ref_mon_sticky" },
+    { ZL_REG_DPLL_STICKY(0),           1, ZL_MAX_CHANNELS, 1, "dpll_sticky" },
+    { ZL_REG_DPLL_REFSEL_STATUS(0),    1, ZL_MAX_CHANNELS, 1, "dpll_refsel_status" },
+    { ZL_REG_REF_FREQ(0),              ZL_REF_FREQ_LEN, ZL_NUM_REFS, ZL_REF_FREQ_LEN, "ref_freq" },
+    { ZL_REG_REF_FREQ_MEAS_CTRL,       1, 1, 0, "ref_freq_meas_ctrl" },
+    { ZL_REG_REF_FREQ_MEAS_MASK,       2, 1, 0, "ref_freq_meas_mask" },
+    { ZL_REG_DPLL_MODE_REFSEL(0),      1, ZL_MAX_CHANNELS, 4, "dpll_mode_refsel" },
+    { ZL_REG_DPLL_PHASE_ERR_READ_MASK, 1, 1, 0, "dpll_phase_err_read_mask" },
+    { ZL_REG_DPLL_PHASE_ERR_DATA(0),   ZL_DPLL_PHASE_ERR_LEN, ZL_MAX_CHANNELS,
+                                       ZL_DPLL_PHASE_ERR_LEN, "dpll_phase_err_data" },
+    { ZL_REG_DPLL_DF_OFFSET(0),        ZL_DPLL_DF_OFFSET_LEN, ZL_MAX_CHANNELS, 8, "dpll_df_offset" },
+};
+
+/* Bit i set when a[i] != b[i], over 16 bytes */
+static inline uint32_t
+snap_mask16(const uint8_t *a, const uint8_t *b)
+{
+#if defined(__SSE2__)
+    __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+                                _mm_loadu_si128((const __m128i *)b));
+
+    return ~(uint32_t)_mm_movemask_epi8(eq) & 0xFFFF;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t weight[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                        1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t ne = vmvnq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)));
+
+    if (vmaxvq_u8(ne) == 0)
+        return 0;
+
+    uint8x16_t bits = vandq_u8(ne, vld1q_u8(weight));
+
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | (uint32_t)vaddv_u8(vget_high_u8(bits)) << 8;
+#else
+    uint64_t wa[2], wb[2];
+    uint32_t m = 0;
+
+    memcpy(wa, a, 16);
+    memcpy(wb, b, 16);
+    if (wa[0] == wb[0] && wa[1] == wb[1])
+        return 0;
+    for (unsigned int i = 0; i < 16; i++)
+        m |= (uint32_t)(a[i] != b[i]) << i;
+    return m;
+#endif
+}
+
+/*
+ * Ranges of bytes that differ between a and b (len a multiple of 16),
+ * at most max of them; returns how many were found
+ */
+size_t
+zl_snap_diff(const uint8_t *a, const uint8_t *b, size_t len, struct zl_range *r, size_t max)
+{
+    size_t n = 0;
+    bool open = false;
+
+    for (size_t i = 0; i < len; i += 16) {
+        uint32_t m = snap_mask16(a + i, b + i);
+
+        if (!m && !open)
+            continue;
+        for (unsigned int j = 0; j < 16; j++) {
+            bool d = m >> j & 1;
+
+            if (d && !open) {
+                if (n == max)
+                    return n;
+                r[n++].start = (uint16_t)(i + j);
+                open = true;
+            } else if (!d && open) {
+                r[n - 1].len = (uint16_t)(i + j - r[n - 1].start);
+                open = false;
+            }
+        }
+    }
+    if (open)
+        r[n - 1].len = (uint16_t)(len - r[n - 1].start);
+
+    return n;
+}
+
+/* Names of the known registers overlapping [reg, reg + len) */
+static void
+snap_annotate(char *buf, size_t size, uint16_t reg, size_t len)
+{
+    size_t n = 0;
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < ARRAY_SIZE(snap_regs) && n < size; i++) {
+        for (unsigned int k = 0; k < snap_regs[i].count && n < size; k++) {
+            unsigned int start = snap_regs[i].reg + k * snap_regs[i].stride;
+
+            if (start >= reg + len || start + snap_regs[i].len <= reg)
+                continue;
+            if (snap_regs[i].count > 1)
+                n += (size_t)snprintf(buf + n, size - n, "%s%s[%u]", n ? "," : "",
+                                      snap_regs[i].name, k);
+            else
+                n += (size_t)snprintf(buf + n, size - n, "%s%s", n ? "," : "",
+                                      snap_regs[i].name);
+        }
+    }
+    for (unsigned int t = 0; t < ZL_MB_NTYPES && n < size; t++) {
+        if (ZL_REG_PAGE(reg) == zl_mb_page(t))
+            n += (size_t)snprintf(buf + n, size - n, "%s%s_mailbox", n ? "," : "",
+                                  zl_mb_name(t));
+    }
+    if (!n)
+        snprintf(buf, size, "-");
+}
+
+static void
+snap_print_hex(const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        printf("%s%02X", i ? " " : "", p[i]);
+}
+
+static void
+snap_print_image(const uint8_t *img)
+{
+    for (unsigned int reg = 0; reg < ZL_SNAP_LEN; reg += 16) {
+        size_t len = ZL_REG_OFF(reg) + 16u > ZL_PAGE_SEL ? 15 : 16;
+
+        printf("0x%04X: ", reg);
+        snap_print_hex(img + reg, len);
+        printf("\n");
+    }
+}
+
+/* Structured output: the image is one record per page, without old bytes */
+static void
+snap_record(uint64_t ts, uint16_t reg, size_t len, const char *names, const uint8_t *old,
+            const uint8_t *cur)
+{
+    static struct zl_rec rec;
+
+    zl_rec_begin(&rec);
+    zl_rec_ts(&rec, "ts", ts);
+    zl_rec_hex(&rec, "reg", reg, 2);
+    zl_rec_u64(&rec, "len", len);
+    zl_rec_str(&rec, "registers", names);
+    zl_rec_bytes(&rec, "old", old, old ? len : 0);
+    zl_rec_bytes(&rec, "new", cur, len);
+    if (zl_rec_end(&rec) < 0)
+        errx(EXIT_FAILURE, "write snapshot record failed");
+}
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void
+dump_usage(void)
+{
+    fprintf(stderr,
+        "Usage: dump [-i interval_us] [-n count] [-q] [-v]\n"
+        "  -i  snapshot interval in microseconds (default 1000000)\n"
+        "  -n  number of snapshots, 0 = until interrupted (default 1)\n"
+        "  -q  do not print the first image, only changes from it\n"
+        "  -v  print snapshot and comparison statistics on exit\n"
+        "Prints the full register image, then only the byte ranges that changed\n"
+    );
+}
+
+int
+cmd_dump(int fd, int argc, char **argv)
+{
+    static struct zl_plan plan;
+    static uint8_t img[2][ZL_SNAP_LEN];
+    static struct zl_range ranges[ZL_SNAP_LEN / 2];
+    uint32_t interval_us = 1000000;
+    unsigned long count = 1, n, nchanged = 0;
+    uint64_t cmp_ns = 0;
+    bool quiet = false, verbose = false;
+    int rx[ZL_NUM_PAGES];
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "i:n:qvh")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_us = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+        default:
+            dump_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || interval_us == 0) {
+        dump_usage();
+        return EXIT_FAILURE;
+    }
+
+    zl_plan_init(&plan);
+    for (unsigned int page = 0; page < ZL_NUM_PAGES; page++) {
+        rx[page] = zl_plan_read(&plan, ZL_REG(page, 0), ZL_PAGE_SEL);
+        if (rx[page] < 0)
+            errx(EXIT_FAILURE, "cannot plan the read of page %u", page);
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (n = 0; !stop && (count == 0 || n < count); n++) {
+        uint8_t *cur = img[n & 1], *prev = img[~n & 1];
+
+        if (n) {
+            next.tv_nsec += (long)(interval_us % 1000000u) * 1000;
+            next.tv_sec += interval_us / 1000000u + next.tv_nsec / 1000000000;
+            next.tv_nsec %= 1000000000;
+            while (!stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+                ;
+            if (stop)
+                break;
+        }
+
+        uint64_t ts = zl_now_ns(CLOCK_REALTIME);
+
+        if (zl_plan_submit(fd, &plan) < 0)
+            errx(EXIT_FAILURE, "register image read failed");
+        for (unsigned int page = 0; page < ZL_NUM_PAGES; page++)
+            memcpy(cur + ZL_REG(page, 0), plan.rx + rx[page], ZL_PAGE_SEL);
+
+        if (n == 0) {
+            if (quiet)
+                continue;
+            if (out_format == ZL_FMT_TEXT)
+                snap_print_image(cur);
+            for (unsigned int page = 0; page < ZL_NUM_PAGES && out_format != ZL_FMT_TEXT; page++)
+                snap_record(ts, ZL_REG(page, 0), ZL_PAGE_SEL, "", NULL, cur + ZL_REG(page, 0));
+            continue;
+        }
+
+        uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+        size_t nr = zl_snap_diff(prev, cur, ZL_SNAP_LEN, ranges, ARRAY_SIZE(ranges));
+
+        cmp_ns += zl_now_ns(CLOCK_MONOTONIC) - t0;
+        nchanged += nr;
+
+        for (size_t i = 0; i < nr; i++) {
+            char names[256];
+
+            snap_annotate(names, sizeof(names), ranges[i].start, ranges[i].len);
+            if (out_format != ZL_FMT_TEXT) {
+                snap_record(ts, ranges[i].start, ranges[i].len, names,
+                            prev + ranges[i].start, cur + ranges[i].start);
+                continue;
+            }
+            printf("%llu.%09llu 0x%04X+%u %s: ", (unsigned long long)(ts / 1000000000u),
+                   (unsigned long long)(ts % 1000000000u), ranges[i].start, ranges[i].len,
+                   names);
+            snap_print_hex(prev + ranges[i].start, ranges[i].len);
+            printf(" -> ");
+            snap_print_hex(cur + ranges[i].start, ranges[i].len);
+            printf("\n");
+        }
+        if (nr && out_format == ZL_FMT_TEXT)
+            fflush(stdout);
+    }
+
+    if (verbose) {
+        fprintf(stderr, "dump: %lu snapshots, %lu changed ranges", n, nchanged);
+        if (n > 1)
+            fprintf(stderr, ", compare %.0f ns mean", (double)cmp_ns / (double)(n - 1));
+        fprintf(stderr, "\n");
+    }
+
+    return EXIT_SUCCESS;
+}
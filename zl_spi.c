@@ -0,0 +1,245 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * ZL3073x register access over Linux spidev
+ * - Every SPI message goes through spi_transfer(), which also routes the
+ *   messages of the simulated device node (zl_sim.c) and, with -B, waits
+ *   for the bus scheduler (zl_bus.c)
+ * - Registers are reached by selecting the page first, then the offset
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+void
+hexdump(const char *prefix, const uint8_t *buf, size_t len)
+{
+    fprintf(stderr, "%s", prefix);
+    for (size_t i = 0; i < len; i++)
+        fprintf(stderr, "%s%02X", i ? " " : "", buf[i]);
+    fprintf(stderr, "\n");
+}
+
+int
+zl_open(const char *path)
+{
+    if (zl_sim_path(path)) {
+        int sfd = zl_sim_open(path);
+
+        if (sfd < 0)
+            errx(EXIT_FAILURE, "open %s failed: %s", path, strerror(-sfd));
+        return sfd;
+    }
+
+    int fd = open(path, O_RDWR);
+
+    if (fd < 0)
+        err(EXIT_FAILURE, "open %s failed", path);
+
+    /* set spi bus settings */
+    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1)
+        err(EXIT_FAILURE, "SPI_IOC_WR_MODE(%d)", mode);
+    if (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) == -1)
+        err(EXIT_FAILURE, "SPI_IOC_WR_BITS_PER_WORD(%d)", bits_per_word);
+    if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) == -1)
+        err(EXIT_FAILURE, "SPI_IOC_WR_MAX_SPEED_HZ(%u)", speed_hz);
+
+    return fd;
+}
+
+int
+spi_transfer(int fd, struct spi_ioc_transfer *xfer, unsigned int n)
+{
+    int ret;
+
+    zl_bus_begin();
+    if (zl_sim_fd(fd))
+        ret = zl_sim_transfer(xfer, n);
+    else
+        ret = ioctl(fd, SPI_IOC_MESSAGE(n), xfer) < 1 ? -1 : 0;
+    zl_bus_end();
+
+    return ret;
+}
+
+int
+spi_write_u8(int fd, uint8_t reg_off, uint8_t val)
+{
+    uint8_t tx[2] = { [0] = reg_off, [1] = val };
+    if (debug > 0) {
+        char pfx[64];
+	snprintf(pfx, sizeof(pfx), "SPI_W: off=0x%02X,  data=", reg_off);
+        hexdump(pfx, &tx[1], 1);
+    }
+    struct spi_ioc_transfer xfer = {
+        .tx_buf = (unsigned long)tx,
+        .rx_buf = 0,
+        .len    = sizeof(tx),
+        .speed_hz = speed_hz,
+        .bits_per_word = bits_per_word,
+        .cs_change = 0
+    };
+
+    return spi_transfer(fd, &xfer, 1);
+}
+
+/*
+ * Per-thread transfer buffers: no allocation on the read path, and the
+ * pages can be faulted in once before entering a real-time loop.
+ */
+static __thread uint8_t spi_tx[ZL_SPI_MAX_READ + 1];
+static __thread uint8_t spi_rx[ZL_SPI_MAX_READ + 1];
+
+void
+spi_prefault(void)
+{
+    memset(spi_tx, 0, sizeof(spi_tx));
+    memset(spi_rx, 0, sizeof(spi_rx));
+}
+
+int
+spi_read(int fd, uint8_t reg_off, uint8_t *buf, size_t len)
+{
+    uint8_t *tx = spi_tx;
+    uint8_t *rx = spi_rx;
+
+    if (len == 0 || len > ZL_SPI_MAX_READ)
+        return -EINVAL;
+
+    tx[0] = 0x80 | (reg_off & 0x7F);
+
+    struct spi_ioc_transfer xfer = {
+        .tx_buf = (unsigned long)tx,
+        .rx_buf = (unsigned long)rx,
+        .len    = (uint32_t)(len + 1),
+        .speed_hz = speed_hz,
+        .bits_per_word = bits_per_word,
+        .cs_change = 0
+    };
+
+    if (spi_transfer(fd, &xfer, 1) < 0)
+        return -1;
+
+    if (debug > 0) {
+      char pfx[64];
+      snprintf(pfx, sizeof(pfx), "SPI_R: off=0x%02X rx=", reg_off);
+      hexdump(pfx, rx + 1, len); /* skip echoed address byte */
+    }
+
+    memcpy(buf, rx + 1, len); /* skip echoed address byte */
+
+    return 0;
+}
+
+int
+zl_set_page(int fd, uint8_t page)
+{
+    if (page > 0x0F)
+        return -EINVAL; /* 4-bit page field */
+
+    if (debug > 0)
+        fprintf(stderr, "PAGE -> 0x%X (write 0x%02X to 0x%02X)\n",
+                        page & 0xf, page & 0xf, ZL_PAGE_SEL);
+
+    return spi_write_u8(fd, ZL_PAGE_SEL, page & 0x0F);
+}
+
+int
+zl_read_reg(int fd, uint16_t reg, uint8_t *buf, size_t len)
+{
+    uint8_t page = ZL_REG_PAGE(reg);
+    uint8_t off  = ZL_REG_OFF(reg);
+
+    /* one scheduler transaction, so no other process moves the page */
+    zl_bus_begin();
+
+    int rc = zl_set_page(fd, page);
+
+    if (!rc)
+        rc = spi_read(fd, off, buf, len);
+    zl_bus_end();
+
+    return rc;
+}
+
+int
+zl_write_reg(int fd, uint16_t reg, const uint8_t *buf, size_t len)
+{
+    uint8_t *tx = spi_tx;
+
+    if (len == 0 || len > ZL_SPI_MAX_READ)
+        return -EINVAL;
+
+    zl_bus_begin();
+
+    int rc = zl_set_page(fd, ZL_REG_PAGE(reg));
+
+    if (rc) {
+        zl_bus_end();
+        return rc;
+    }
+
+    tx[0] = ZL_REG_OFF(reg);
+    memcpy(tx + 1, buf, len);
+    if (debug > 0) {
+        char pfx[64];
+        snprintf(pfx, sizeof(pfx), "SPI_W: off=0x%02X,  data=", tx[0]);
+        hexdump(pfx, buf, len);
+    }
+
+    struct spi_ioc_transfer xfer = {
+        .tx_buf = (unsigned long)tx,
+        .rx_buf = 0,
+        .len    = (uint32_t)(len + 1),
+        .speed_hz = speed_hz,
+        .bits_per_word = bits_per_word,
+        .cs_change = 0
+    };
+
+    rc = spi_transfer(fd, &xfer, 1);
+    zl_bus_end();
+    memset(tx, 0, len + 1); /* spi_read() relies on a zeroed tx tail */
+
+    return rc;
+}
+
+/*
+ * Parse "REG[:LEN]" (e.g. "0x0001:2"); LEN defaults to 1 byte.
+ * The block must stay within one page and not cover the page select.
+ */
+int
+zl_parse_watch(const char *arg, struct zl_watch *w)
+{
+    char *end;
+    unsigned long reg = strtoul(arg, &end, 0);
+    unsigned long len = 1;
+
+    if (end == arg)
+        return -EINVAL;
+    if (*end == ':') {
+        const char *p = end + 1;
+        len = strtoul(p, &end, 0);
+        if (end == p)
+            return -EINVAL;
+    }
+    if (*end != '\0')
+        return -EINVAL;
+
+    if (reg >= ZL_NUM_PAGES * ZL_PAGE_SIZE || len == 0 ||
+        ZL_REG_OFF(reg) + len > ZL_WATCH_MAX_LEN)
+        return -ERANGE;
+
+    w->reg = (uint16_t)reg;
+    w->len = (uint8_t)len;
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Persistent per-device state (tuned SPI settings, ...)
+ * - One "DEVNODE KEY VALUE" line per setting, in state_path
+ * - Updates rewrite a temporary file renamed over the original, so a
+ *   reader never sees a partial file; concurrent updates take turns on
+ *   a lock file next to it, and the temporary names are unique
+ * - The directory of state_path is created on the first update
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "zl3073x.h"
+
+#define STATE_LINE_MAX  256
+
+static bool
+state_match(char *line, const char *dev, const char *key, char **val)
+{
+    char *save, *d = strtok_r(line, " \t\r\n", &save);
+    char *k = strtok_r(NULL, " \t\r\n", &save);
+    char *v = strtok_r(NULL, " \t\r\n", &save);
+
+    if (!d || !k || !v || d[0] == '#')
+        return false;
+    *val = v;
+    return !strcmp(d, dev) && !strcmp(k, key);
+}
+
+/* Value of key for dev into val, -ENOENT if not set */
+int
+zl_state_get(const char *dev, const char *key, char *val, size_t size)
+{
+    char line[STATE_LINE_MAX], *v;
+    FILE *f = fopen(state_path, "r");
+    int rc = -ENOENT;
+
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        if (state_match(line, dev, key, &v)) {
+            snprintf(val, size, "%s", v);
+            rc = 0;
+        }
+    }
+    fclose(f);
+
+    return rc;
+}
+
+/* Create the missing directories leading to path */
+static int
+state_mkdir(const char *path)
+{
+    char dir[4096];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+            return -errno;
+        *p = '/';
+    }
+    return 0;
+}
+
+/* Set (or replace) key for dev, keeping every other line */
+int
+zl_state_set(const char *dev, const char *key, const char *val)
+{
+    char line[STATE_LINE_MAX], copy[STATE_LINE_MAX], tmp[4096], *v;
+    FILE *in = NULL, *out = NULL;
+    int rc, fd, lock;
+
+    rc = state_mkdir(state_path);
+    if (rc < 0)
+        return rc;
+
+    /* the read-modify-write is serialized, so no update is lost */
+    snprintf(tmp, sizeof(tmp), "%s.lock", state_path);
+    lock = open(tmp, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0)
+        return -errno;
+    if (flock(lock, LOCK_EX) < 0) {
+        rc = -errno;
+        goto out_lock;
+    }
+
+    in = fopen(state_path, "r");
+    if (!in && errno != ENOENT) {
+        rc = -errno;
+        goto out_lock;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", state_path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        rc = -errno;
+        goto out_in;
+    }
+    out = fdopen(fd, "w");
+    if (!out) {
+        rc = -errno;
+        close(fd);
+        goto out_tmp;
+    }
+    if (fchmod(fd, 0644) < 0) {
+        rc = -errno;
+        fclose(out);
+        goto out_tmp;
+    }
+
+    while (in && fgets(line, sizeof(line), in)) {
+        memcpy(copy, line, sizeof(copy));
+        if (!state_match(copy, dev, key, &v))
+            fputs(line, out);
+    }
+    fprintf(out, "%s %s %s\n", dev, key, val);
+
+    if (fclose(out))
+        rc = -errno;
+    else if (rename(tmp, state_path) < 0)
+        rc = -errno;
+out_tmp:
+    if (rc < 0)
+        remove(tmp);
+out_in:
+    if (in)
+        fclose(in);
+out_lock:
+    close(lock);
+    return rc;
+}
@@ -0,0 +1,381 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Streaming MTIE / TDEV / ADEV (see zl_stats.h)
+ * - MTIE: sliding-window max and min over block extrema, each kept in a
+ *   monotonic deque, so every window costs O(1) amortized
+ * - TDEV: prefix sums of the series in a ring of 3n+1 entries; the inner
+ *   sum of second differences for start j is
+ *       P[j+3n] - 3 P[j+2n] + 3 P[j+n] - P[j]
+ *   computed in wrapping 64-bit arithmetic, exact for integer samples
+ * - ADEV: same scheme on frequency samples with a ring of 2n+1 entries,
+ *       P[j+2n] - 2 P[j+n] + P[j]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zl3073x.h"
+#include "zl_stats.h"
+
+static int
+deque_init(struct zl_deque *q, uint32_t cap)
+{
+    q->cap = cap;
+    q->head = q->len = 0;
+    q->idx = calloc(cap, sizeof(*q->idx));
+    q->val = calloc(cap, sizeof(*q->val));
+    return (q->idx && q->val) ? 0 : -ENOMEM;
+}
+
+static void
+deque_free(struct zl_deque *q)
+{
+    free(q->idx);
+    free(q->val);
+}
+
+#define DQ_AT(q, i) (((q)->head + (i)) % (q)->cap)
+
+/* Push (idx, v), dropping entries dominated by v; sign +1 = max, -1 = min */
+static void
+deque_push(struct zl_deque *q, uint64_t idx, int64_t v, int sign)
+{
+    while (q->len) {
+        int64_t back = q->val[DQ_AT(q, q->len - 1)];
+        if ((sign > 0) ? (back > v) : (back < v))
+            break;
+        q->len--;
+    }
+    q->idx[DQ_AT(q, q->len)] = idx;
+    q->val[DQ_AT(q, q->len)] = v;
+    q->len++;
+}
+
+static void
+deque_expire(struct zl_deque *q, uint64_t first_idx)
+{
+    while (q->len && q->idx[q->head] < first_idx) {
+        q->head = (q->head + 1) % q->cap;
+        q->len--;
+    }
+}
+
+int
+zl_tie_init(struct zl_tie_stats *s, double tau0, double tau_max)
+{
+    memset(s, 0, sizeof(*s));
+    s->tau0 = tau0;
+
+    for (uint64_t n = 1; s->ntau < ZL_STATS_MAX_TAU && n * tau0 <= tau_max * (1 + 1e-9); n *= 2) {
+        struct zl_tie_tau *t = &s->tau[s->ntau];
+
+        t->n = n;
+        t->d = n > ZL_STATS_WINDOW ? (uint32_t)(n / ZL_STATS_WINDOW) : 1;
+        t->nb = (uint32_t)(n / t->d);
+        /* exact MTIE spans n+1 samples; decimated windows n/d blocks */
+        t->m = t->d == 1 ? t->nb + 1 : t->nb;
+        t->plen = 3 * t->nb + 1;
+        t->prefix = calloc(t->plen, sizeof(*t->prefix));
+        s->ntau++;
+
+        if (!t->prefix || deque_init(&t->dmax, t->m) < 0 || deque_init(&t->dmin, t->m) < 0) {
+            zl_tie_free(s);
+            return -ENOMEM;
+        }
+    }
+
+    return s->ntau ? 0 : -EINVAL;
+}
+
+void
+zl_tie_free(struct zl_tie_stats *s)
+{
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        free(s->tau[i].prefix);
+        deque_free(&s->tau[i].dmax);
+        deque_free(&s->tau[i].dmin);
+    }
+    s->ntau = 0;
+}
+
+static void
+tau_block(struct zl_tie_tau *t, int64_t bsum, int64_t bmin, int64_t bmax)
+{
+    uint64_t b = t->nblocks++;
+
+    /* MTIE over the last m blocks */
+    uint64_t first = (b + 1 >= t->m) ? b + 1 - t->m : 0;
+
+    deque_expire(&t->dmax, first);
+    deque_expire(&t->dmin, first);
+    deque_push(&t->dmax, b, bmax, +1);
+    deque_push(&t->dmin, b, bmin, -1);
+    if (b + 1 >= t->m) {
+        int64_t pp = t->dmax.val[t->dmax.head] - t->dmin.val[t->dmin.head];
+        if (pp > t->mtie)
+            t->mtie = pp;
+        t->nmtie++;
+    }
+
+    /* TDEV: P[b+1] = P[b] + block sum */
+    uint64_t k = b + 1;
+    uint32_t nb = t->nb;
+
+    t->psum += (uint64_t)bsum;
+    t->prefix[k % t->plen] = t->psum;
+    if (k >= 3 * (uint64_t)nb) {
+        int64_t sd = (int64_t)(t->prefix[k % t->plen]
+                               - 3 * t->prefix[(k - nb) % t->plen]
+                               + 3 * t->prefix[(k - 2 * nb) % t->plen]
+                               - t->prefix[(k - 3 * nb) % t->plen]);
+        t->s2 += (double)sd * (double)sd;
+        t->ns2++;
+    }
+}
+
+void
+zl_tie_add(struct zl_tie_stats *s, int64_t x)
+{
+    s->nsamples++;
+
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        struct zl_tie_tau *t = &s->tau[i];
+
+        if (t->acc_cnt == 0) {
+            t->acc_sum = 0;
+            t->acc_min = t->acc_max = x;
+        } else {
+            if (x < t->acc_min)
+                t->acc_min = x;
+            if (x > t->acc_max)
+                t->acc_max = x;
+        }
+        t->acc_sum += x;
+        if (++t->acc_cnt == t->d) {
+            tau_block(t, t->acc_sum, t->acc_min, t->acc_max);
+            t->acc_cnt = 0;
+        }
+    }
+}
+
+/* Missing sample: no window may span it */
+void
+zl_tie_gap(struct zl_tie_stats *s)
+{
+    s->ngaps++;
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        struct zl_tie_tau *t = &s->tau[i];
+
+        t->acc_cnt = 0;
+        t->nblocks = 0;
+        t->dmax.head = t->dmax.len = 0;
+        t->dmin.head = t->dmin.len = 0;
+        t->psum = 0;
+        t->prefix[0] = 0;
+    }
+}
+
+double
+zl_tie_mtie_ns(const struct zl_tie_tau *t)
+{
+    return t->nmtie ? (double)t->mtie / 1e3 : -1;
+}
+
+double
+zl_tie_tdev_ns(const struct zl_tie_tau *t)
+{
+    if (!t->ns2)
+        return -1;
+    return sqrt(t->s2 / (double)t->ns2 / (6.0 * (double)t->n * (double)t->n)) / 1e3;
+}
+
+int
+zl_adev_init(struct zl_adev_stats *s, double tau0, double tau_max, double scale)
+{
+    memset(s, 0, sizeof(*s));
+    s->tau0 = tau0;
+    s->scale = scale;
+
+    for (uint64_t n = 1; s->ntau < ZL_STATS_MAX_TAU && n * tau0 <= tau_max * (1 + 1e-9); n *= 2) {
+        struct zl_adev_tau *t = &s->tau[s->ntau];
+
+        t->n = n;
+        t->d = n > ZL_STATS_WINDOW ? (uint32_t)(n / ZL_STATS_WINDOW) : 1;
+        t->nb = (uint32_t)(n / t->d);
+        t->plen = 2 * t->nb + 1;
+        t->prefix = calloc(t->plen, sizeof(*t->prefix));
+        s->ntau++;
+
+        if (!t->prefix) {
+            zl_adev_free(s);
+            return -ENOMEM;
+        }
+    }
+
+    return s->ntau ? 0 : -EINVAL;
+}
+
+void
+zl_adev_free(struct zl_adev_stats *s)
+{
+    for (unsigned int i = 0; i < s->ntau; i++)
+        free(s->tau[i].prefix);
+    s->ntau = 0;
+}
+
+void
+zl_adev_add(struct zl_adev_stats *s, int64_t y)
+{
+    s->nsamples++;
+
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        struct zl_adev_tau *t = &s->tau[i];
+
+        t->acc_sum += y;
+        if (++t->acc_cnt < t->d)
+            continue;
+
+        uint64_t k = ++t->nblocks;
+        uint32_t nb = t->nb;
+
+        t->psum += (uint64_t)t->acc_sum;
+        t->prefix[k % t->plen] = t->psum;
+        t->acc_sum = 0;
+        t->acc_cnt = 0;
+        if (k >= 2 * (uint64_t)nb) {
+            int64_t sd = (int64_t)(t->prefix[k % t->plen]
+                                   - 2 * t->prefix[(k - nb) % t->plen]
+                                   + t->prefix[(k - 2 * nb) % t->plen]);
+            t->s2 += (double)sd * (double)sd;
+            t->ns2++;
+        }
+    }
+}
+
+void
+zl_adev_gap(struct zl_adev_stats *s)
+{
+    s->ngaps++;
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        struct zl_adev_tau *t = &s->tau[i];
+
+        t->acc_cnt = 0;
+        t->acc_sum = 0;
+        t->nblocks = 0;
+        t->psum = 0;
+        t->prefix[0] = 0;
+    }
+}
+
+double
+zl_adev(const struct zl_adev_stats *s, const struct zl_adev_tau *t)
+{
+    if (!t->ns2)
+        return -1;
+    return sqrt(t->s2 / (double)t->ns2 / (2.0 * (double)t->n * (double)t->n)) * s->scale;
+}
+
+/* limit = a * tau^b for lo < tau <= hi */
+struct mask_seg {
+    double lo, hi, a, b;
+};
+
+static const struct mask_seg g8262_opt1_mtie[] = {
+    { 0.1,   1.0,    40.0,  0.0 },
+    { 1.0,   100.0,  40.0,  0.1 },
+    { 100.0, 1000.0, 25.25, 0.2 },
+};
+
+static const struct mask_seg g8262_opt1_tdev[] = {
+    { 0.1,   25.0,   3.2,   0.0 },
+    { 25.0,  100.0,  0.64,  0.5 },
+    { 100.0, 1000.0, 6.4,   0.0 },
+};
+
+static double
+mask_eval(const struct mask_seg *m, size_t n, double tau)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (tau > m[i].lo && tau <= m[i].hi)
+            return m[i].a * pow(tau, m[i].b);
+    }
+    return -1;
+}
+
+double
+zl_mask_mtie_ns(double tau)
+{
+    return mask_eval(g8262_opt1_mtie, ARRAY_SIZE(g8262_opt1_mtie), tau);
+}
+
+double
+zl_mask_tdev_ns(double tau)
+{
+    return mask_eval(g8262_opt1_tdev, ARRAY_SIZE(g8262_opt1_tdev), tau);
+}
+
+static const char *
+verdict(double v, double mask)
+{
+    if (v < 0 || mask < 0)
+        return "-";
+    return v <= mask ? "PASS" : "FAIL";
+}
+
+/* Right-aligned value, or "-" when negative (not available) */
+static const char *
+fmt_val(char *buf, size_t len, int width, int prec, double v)
+{
+    if (v < 0)
+        snprintf(buf, len, "%*s", width, "-");
+    else
+        snprintf(buf, len, "%*.*f", width, prec, v);
+    return buf;
+}
+
+void
+zl_tie_report(const struct zl_tie_stats *s, const char *name, FILE *f)
+{
+    fprintf(f, "%s: %llu samples, %llu gaps, tau0 %g s, G.8262 EEC option 1 masks\n",
+            name, (unsigned long long)s->nsamples, (unsigned long long)s->ngaps, s->tau0);
+    fprintf(f, "  %12s %12s %10s %-4s %12s %10s %-4s\n",
+            "tau(s)", "MTIE(ns)", "mask", "", "TDEV(ns)", "mask", "");
+
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        const struct zl_tie_tau *t = &s->tau[i];
+        double tau = (double)t->n * s->tau0;
+        double mtie = zl_tie_mtie_ns(t), tdev = zl_tie_tdev_ns(t);
+        double mm = zl_mask_mtie_ns(tau), tm = zl_mask_tdev_ns(tau);
+        char b[4][32];
+
+        if (mtie < 0 && tdev < 0)
+            break;
+        fprintf(f, "  %12.4f %s %s %-4s %s %s %-4s\n", tau,
+                fmt_val(b[0], sizeof(b[0]), 12, 3, mtie),
+                fmt_val(b[1], sizeof(b[1]), 10, 3, mm), verdict(mtie, mm),
+                fmt_val(b[2], sizeof(b[2]), 12, 3, tdev),
+                fmt_val(b[3], sizeof(b[3]), 10, 3, tm), verdict(tdev, tm));
+    }
+}
+
+void
+zl_adev_report(const struct zl_adev_stats *s, const char *name, FILE *f)
+{
+    fprintf(f, "%s: %llu samples, %llu gaps, tau0 %g s\n",
+            name, (unsigned long long)s->nsamples, (unsigned long long)s->ngaps, s->tau0);
+    fprintf(f, "  %12s %12s %10s\n", "tau(s)", "ADEV", "terms");
+
+    for (unsigned int i = 0; i < s->ntau; i++) {
+        const struct zl_adev_tau *t = &s->tau[i];
+        double adev = zl_adev(s, t);
+
+        if (adev < 0)
+            break;
+        fprintf(f, "  %12.4f %12.4e %10llu\n", (double)t->n * s->tau0, adev,
+                (unsigned long long)t->ns2);
+    }
+}
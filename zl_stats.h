@@ -0,0 +1,106 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * Streaming timing analytics fed by the polling mode
+ *
+ * MTIE, TDEV and ADEV are evaluated for tau = 2^k * tau0. Up to ZL_STATS_WINDOW
+ * samples per tau the estimators are exact; beyond that the input is
+ * decimated into blocks (min/max/sum) so that every tau keeps at most
+ * ZL_STATS_WINDOW blocks: work per sample is O(1) amortized per tau and
+ * memory does not depend on the capture length. For decimated taus, the
+ * MTIE windows and TDEV start points are block-aligned.
+ *
+ * A missing sample (zl_*_gap()) restarts the windows of every tau after
+ * it, so no estimate spans the gap; what was accumulated before is kept.
+ */
+
+#ifndef ZL_STATS_H
+#define ZL_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ZL_STATS_MAX_TAU  32
+#define ZL_STATS_WINDOW   1024
+
+/* Monotonic ring-buffer deque of (block index, value) */
+struct zl_deque {
+    uint32_t cap, head, len;
+    uint64_t *idx;
+    int64_t *val;
+};
+
+struct zl_tie_tau {
+    uint64_t n;             /* tau in samples */
+    uint32_t d;             /* samples per block */
+    uint32_t m;             /* MTIE window, in blocks */
+    uint32_t nb;            /* TDEV n, in blocks */
+
+    uint32_t acc_cnt;       /* block being accumulated */
+    int64_t acc_sum, acc_min, acc_max;
+    uint64_t nblocks;
+
+    struct zl_deque dmax, dmin;
+    int64_t mtie;
+    uint64_t nmtie;
+
+    uint64_t *prefix;       /* ring of 3*nb+1 prefix sums (mod 2^64) */
+    uint32_t plen;
+    uint64_t psum;
+    double s2;
+    uint64_t ns2;
+};
+
+/* MTIE/TDEV of one time-error (phase) series, values in ps */
+struct zl_tie_stats {
+    double tau0;            /* sampling interval, s */
+    unsigned int ntau;
+    uint64_t nsamples, ngaps;
+    struct zl_tie_tau tau[ZL_STATS_MAX_TAU];
+};
+
+int zl_tie_init(struct zl_tie_stats *s, double tau0, double tau_max);
+void zl_tie_free(struct zl_tie_stats *s);
+void zl_tie_add(struct zl_tie_stats *s, int64_t x_ps);
+void zl_tie_gap(struct zl_tie_stats *s);
+double zl_tie_mtie_ns(const struct zl_tie_tau *t);
+double zl_tie_tdev_ns(const struct zl_tie_tau *t);
+void zl_tie_report(const struct zl_tie_stats *s, const char *name, FILE *f);
+
+/* Overlapping Allan deviation of one fractional frequency series */
+struct zl_adev_tau {
+    uint64_t n;             /* tau in samples */
+    uint32_t d;             /* samples per block */
+    uint32_t nb;            /* n, in blocks */
+
+    uint32_t acc_cnt;
+    int64_t acc_sum;
+    uint64_t nblocks;
+
+    uint64_t *prefix;       /* ring of 2*nb+1 prefix sums (mod 2^64) */
+    uint32_t plen;
+    uint64_t psum;
+    double s2;
+    uint64_t ns2;
+};
+
+struct zl_adev_stats {
+    double tau0;            /* sampling interval, s */
+    double scale;           /* fractional frequency of one sample unit */
+    unsigned int ntau;
+    uint64_t nsamples, ngaps;
+    struct zl_adev_tau tau[ZL_STATS_MAX_TAU];
+};
+
+int zl_adev_init(struct zl_adev_stats *s, double tau0, double tau_max, double scale);
+void zl_adev_free(struct zl_adev_stats *s);
+void zl_adev_add(struct zl_adev_stats *s, int64_t y);
+void zl_adev_gap(struct zl_adev_stats *s);
+double zl_adev(const struct zl_adev_stats *s, const struct zl_adev_tau *t);
+void zl_adev_report(const struct zl_adev_stats *s, const char *name, FILE *f);
+
+/* G.8262 EEC option 1 wander masks (constant temperature), ns; <0 = none */
+double zl_mask_mtie_ns(double tau);
+double zl_mask_tdev_ns(double tau);
+
+#endif /* ZL_STATS_H */
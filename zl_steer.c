@@ -0,0 +1,255 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * DPLL NCO frequency steering for external servo loops
+ * - The SPI message (page select + 6-byte offset write) is built once;
+ *   each update only patches the data bytes and issues one ioctl
+ * - Offsets arrive as ppb values, one per line on stdin or one per
+ *   datagram on a socket
+ * - Write latency (ioctl only) and end-to-end latency (input received
+ *   to write completed) are histogrammed and reported
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zl3073x.h"
+
+#define DF_MAX  ((INT64_C(1) << 47) - 1)
+#define DF_MIN  (-(INT64_C(1) << 47))
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* ppb to the s48 fractional frequency offset word (2^-48 units), saturated */
+int64_t
+zl_ppb_to_df(double ppb)
+{
+    double df = nearbyint(ppb * 1e-9 * 281474976710656.0 /* 2^48 */);
+
+    if (df >= (double)DF_MAX)
+        return DF_MAX;
+    if (df <= (double)DF_MIN)
+        return DF_MIN;
+    return (int64_t)df;
+}
+
+int
+zl_steer_init(struct zl_steer *s, int fd, unsigned int channel)
+{
+    uint16_t reg = ZL_REG_DPLL_DF_OFFSET(channel);
+
+    if (channel >= ZL_MAX_CHANNELS)
+        return -EINVAL;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->page_tx[0] = ZL_PAGE_SEL;
+    s->page_tx[1] = ZL_REG_PAGE(reg);
+    s->data_tx[0] = ZL_REG_OFF(reg);
+
+    s->xfer[0].tx_buf = (unsigned long)s->page_tx;
+    s->xfer[0].len = sizeof(s->page_tx);
+    s->xfer[0].cs_change = 1;   /* separate SPI transactions */
+    s->xfer[1].tx_buf = (unsigned long)s->data_tx;
+    s->xfer[1].len = sizeof(s->data_tx);
+    for (size_t i = 0; i < ARRAY_SIZE(s->xfer); i++) {
+        s->xfer[i].speed_hz = speed_hz;
+        s->xfer[i].bits_per_word = bits_per_word;
+    }
+
+    return 0;
+}
+
+int
+zl_steer_write(struct zl_steer *s, double ppb)
+{
+    uint64_t df = (uint64_t)zl_ppb_to_df(ppb);
+
+    for (int i = 0; i < ZL_DPLL_DF_OFFSET_LEN; i++)
+        s->data_tx[1 + i] = (uint8_t)(df >> (8 * (ZL_DPLL_DF_OFFSET_LEN - 1 - i)));
+
+    if (debug > 0) {
+        char pfx[64];
+        snprintf(pfx, sizeof(pfx), "STEER: %.3f ppb page=%u off=0x%02X data=",
+                 ppb, s->page_tx[1], s->data_tx[0]);
+        hexdump(pfx, s->data_tx + 1, ZL_DPLL_DF_OFFSET_LEN);
+    }
+
+    return spi_transfer(s->fd, s->xfer, ARRAY_SIZE(s->xfer));
+}
+
+static int
+set_nco_mode(int fd, unsigned int channel)
+{
+    uint8_t v;
+
+    if (zl_read_reg(fd, ZL_REG_DPLL_MODE_REFSEL(channel), &v, 1) < 0)
+        return -1;
+    v = (uint8_t)((v & ~ZL_DPLL_MODE_MASK) | ZL_DPLL_MODE_NCO);
+    return zl_write_reg(fd, ZL_REG_DPLL_MODE_REFSEL(channel), &v, 1);
+}
+
+static void
+steer_usage(void)
+{
+    fprintf(stderr,
+        "Usage: steer [--channel N] [-N] [-S socket] [-v]\n"
+        "             [--realtime [--cpu N] [--prio N]]\n"
+        "      --channel   DPLL channel (default 0)\n"
+        "  -N  switch the channel to NCO mode first\n"
+        "  -S  read ppb values from datagrams on unix:PATH, HOST:PORT or PORT\n"
+        "      (default: one value per line on stdin)\n"
+        "  -v  report latencies every 10 s, not only on exit\n"
+        "  -R, --realtime  lock and prefault memory, run SCHED_FIFO\n"
+        "  -c, --cpu       pin the steering thread to this CPU\n"
+        "  -p, --prio      SCHED_FIFO priority (default 50)\n"
+    );
+}
+
+int
+cmd_steer(int fd, int argc, char **argv)
+{
+    const char *sockspec = NULL;
+    unsigned int channel = 0;
+    bool nco = false, verbose = false, realtime = false;
+    int cpu = -1, prio = 50;
+    int opt, sfd = -1;
+
+    static const struct option long_opts[] = {
+        {"realtime", no_argument, 0, 'R'},
+        {"channel", required_argument, 0, 'k'},
+        {"cpu", required_argument, 0, 'c'},
+        {"prio", required_argument, 0, 'p'},
+        {}
+    };
+
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "NS:vRc:p:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'k':
+            channel = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            nco = true;
+            break;
+        case 'S':
+            sockspec = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'R':
+            realtime = true;
+            break;
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 'p':
+            prio = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            steer_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        steer_usage();
+        return EXIT_FAILURE;
+    }
+
+    struct zl_steer st;
+    if (zl_steer_init(&st, fd, channel) < 0)
+        errx(EXIT_FAILURE, "invalid DPLL channel %u", channel);
+    if (nco && set_nco_mode(fd, channel) < 0)
+        errx(EXIT_FAILURE, "cannot switch DPLL %u to NCO mode", channel);
+
+    if (sockspec) {
+        sfd = zl_socket_bind(sockspec, SOCK_DGRAM);
+        if (sfd < 0)
+            errx(EXIT_FAILURE, "bind %s: %s", sockspec, strerror(-sfd));
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (realtime && zl_rt_enter(cpu, prio) < 0)
+        errx(EXIT_FAILURE, "cannot enter realtime mode (needs CAP_SYS_NICE/CAP_IPC_LOCK)");
+
+    struct zl_lat wr_lat, e2e_lat;
+    uint64_t last_report = zl_now_ns(CLOCK_MONOTONIC), errors = 0;
+    char buf[128];
+
+    zl_lat_init(&wr_lat);
+    zl_lat_init(&e2e_lat);
+
+    while (!stop) {
+        if (sfd >= 0) {
+            ssize_t n = recv(sfd, buf, sizeof(buf) - 1, 0);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                err(EXIT_FAILURE, "recv %s", sockspec);
+            }
+            buf[n] = '\0';
+        } else if (!fgets(buf, sizeof(buf), stdin)) {
+            break;
+        }
+
+        uint64_t t_in = zl_now_ns(CLOCK_MONOTONIC);
+        char *end;
+
+        buf[strcspn(buf, "\r\n")] = '\0';
+        double ppb = strtod(buf, &end);
+
+        if (end == buf) {
+            if (debug > 0)
+                warnx("ignoring '%s'", buf);
+            continue;
+        }
+
+        uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+        if (zl_steer_write(&st, ppb) < 0) {
+            errors++;
+            continue;
+        }
+        uint64_t t1 = zl_now_ns(CLOCK_MONOTONIC);
+
+        zl_lat_add(&wr_lat, t1 - t0);
+        zl_lat_add(&e2e_lat, t1 - t_in);
+
+        if (verbose && t1 - last_report >= 10000000000ull) {
+            zl_lat_report(&wr_lat, "steer write");
+            zl_lat_report(&e2e_lat, "steer end-to-end");
+            last_report = t1;
+        }
+    }
+
+    zl_lat_report(&wr_lat, "steer write");
+    zl_lat_report(&e2e_lat, "steer end-to-end");
+    if (errors)
+        fprintf(stderr, "steer: %llu failed writes\n", (unsigned long long)errors);
+
+    if (sfd >= 0)
+        close(sfd);
+
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
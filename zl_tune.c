@@ -0,0 +1,387 @@
+/* Copyright Free Mobile 2025 */
+
+/*
+ * SPI clock auto-tuning
+ * - The identity registers (chip ID, revision, firmware and config
+ *   versions) are constant: they are read at the starting speed as a
+ *   reference, then compared at each higher speed
+ * - The output mailbox data registers only stage a configuration until
+ *   the semaphore is written, so they serve as a write/readback scratch
+ *   area; their content is restored at the end
+ * - Each iteration is one SPI message: pattern write, identity read and
+ *   scratch readback. Speeds are stepped up until one shows an error;
+ *   the highest speed below the last clean one minus a margin is kept
+ *
+ * Stress test (bit error rate at one speed and mode)
+ * - Every message is one identity burst read followed by as many pattern
+ *   write/readback pairs as fit: the plan is built once and only the
+ *   patterns are rewritten in its tx buffer between messages
+ * - Errors are counted per bit position; throughput and the message
+ *   latency distribution are reported too
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zl3073x.h"
+
+#define TUNE_ID_REG       ZL_REG_ID
+#define TUNE_ID_LEN       (ZL_REG_CUSTOM_CONFIG_VER + 4 - ZL_REG_ID)
+#define TUNE_SCRATCH_REG  ZL_REG(14, ZL_MB_DATA)
+#define TUNE_SCRATCH_LEN  ZL_MB_DATA_LEN
+
+/* Common controller clock dividers */
+static const uint32_t tune_speeds[] = {
+    1000000, 2000000, 4000000, 5000000, 8000000, 10000000, 12500000,
+    16000000, 20000000, 25000000, 33000000, 40000000, 50000000,
+};
+
+/* Pattern write/readback pairs per stress message, within ZL_PLAN_BUF */
+#define STRESS_PAIRS  15
+
+struct tune_step {
+    uint32_t speed_hz;
+    unsigned long iters, bad, bit_errors;
+};
+
+static uint32_t
+xorshift32(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static unsigned int
+bit_errors(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    unsigned int n = 0;
+
+    for (size_t i = 0; i < len; i++)
+        n += (unsigned int)__builtin_popcount(a[i] ^ b[i]);
+    return n;
+}
+
+/* Bit errors of len bytes, per bit position (0 = LSB) */
+static unsigned int
+bit_errors_pos(const uint8_t *a, const uint8_t *b, size_t len, uint64_t *pos)
+{
+    unsigned int n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t x = a[i] ^ b[i];
+
+        for (; x; x &= (uint8_t)(x - 1)) {
+            pos[__builtin_ctz(x)]++;
+            n++;
+        }
+    }
+    return n;
+}
+
+/* One speed: iters messages of pattern write, identity read, readback */
+static void
+tune_step(int fd, struct tune_step *s, const uint8_t *id_ref, unsigned long iters)
+{
+    static struct zl_plan plan;
+    uint8_t pattern[TUNE_SCRATCH_LEN];
+    uint32_t seed = s->speed_hz;
+
+    speed_hz = s->speed_hz;
+    for (s->iters = 0; s->iters < iters; s->iters++) {
+        for (size_t i = 0; i < sizeof(pattern); i++)
+            pattern[i] = (uint8_t)xorshift32(&seed);
+
+        zl_plan_init(&plan);
+        int wr = zl_plan_write(&plan, TUNE_SCRATCH_REG, pattern, sizeof(pattern));
+        int id = zl_plan_read(&plan, TUNE_ID_REG, TUNE_ID_LEN);
+        int back = zl_plan_read(&plan, TUNE_SCRATCH_REG, sizeof(pattern));
+
+        if (wr < 0 || id < 0 || back < 0)
+            errx(EXIT_FAILURE, "cannot plan the tuning transfer");
+        if (zl_plan_submit(fd, &plan) < 0) {
+            s->bad++;
+            continue;
+        }
+
+        unsigned int n = bit_errors(plan.rx + id, id_ref, TUNE_ID_LEN) +
+                         bit_errors(plan.rx + back, pattern, sizeof(pattern));
+
+        if (n) {
+            s->bad++;
+            s->bit_errors += n;
+        }
+    }
+}
+
+static void
+tune_usage(void)
+{
+    fprintf(stderr,
+        "Usage: tune [-u max_hz] [-n iterations] [-M margin_pct] [-w]\n"
+        "  -u  highest speed tried (default 25000000)\n"
+        "  -n  verification messages per speed (default 200)\n"
+        "  -M  safety margin below the highest clean speed (default 20%%)\n"
+        "  -w  save the selected speed to the state file\n"
+        "Steps the SPI clock up from the -s speed, verifying each step\n"
+    );
+}
+
+int
+cmd_tune(int fd, int argc, char **argv)
+{
+    struct tune_step steps[ARRAY_SIZE(tune_speeds) + 1];
+    uint32_t start_hz = speed_hz, max_hz = 25000000;
+    unsigned long iters = 200;
+    unsigned int margin = 20, nsteps = 0;
+    bool save = false;
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "u:n:M:wh")) != -1) {
+        switch (opt) {
+        case 'u':
+            max_hz = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            iters = strtoul(optarg, NULL, 0);
+            break;
+        case 'M':
+            margin = (unsigned int)strtoul(optarg, NULL, 0);
+            if (margin >= 100)
+                errx(EXIT_FAILURE, "invalid margin %s%%", optarg);
+            break;
+        case 'w':
+            save = true;
+            break;
+        case 'h':
+        default:
+            tune_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || iters == 0) {
+        tune_usage();
+        return EXIT_FAILURE;
+    }
+
+    /* reference values at the starting speed, read twice to trust them */
+    uint8_t id_ref[TUNE_ID_LEN], id_chk[TUNE_ID_LEN], scratch[TUNE_SCRATCH_LEN];
+
+    if (zl_read_reg(fd, TUNE_ID_REG, id_ref, sizeof(id_ref)) < 0 ||
+        zl_read_reg(fd, TUNE_ID_REG, id_chk, sizeof(id_chk)) < 0 ||
+        zl_read_reg(fd, TUNE_SCRATCH_REG, scratch, sizeof(scratch)) < 0)
+        errx(EXIT_FAILURE, "read reference registers failed at %u Hz", start_hz);
+    if (memcmp(id_ref, id_chk, sizeof(id_ref)))
+        errx(EXIT_FAILURE, "identity registers unstable at %u Hz, lower -s", start_hz);
+
+    uint16_t chip_id = (uint16_t)((id_ref[0] << 8) | id_ref[1]);
+
+    if (chip_id == 0x0000 || chip_id == 0xFFFF)
+        errx(EXIT_FAILURE, "no device answering at %u Hz (chip ID 0x%04X)", start_hz, chip_id);
+
+    steps[nsteps++] = (struct tune_step){ .speed_hz = start_hz };
+    for (size_t i = 0; i < ARRAY_SIZE(tune_speeds); i++) {
+        if (tune_speeds[i] > start_hz && tune_speeds[i] <= max_hz)
+            steps[nsteps++] = (struct tune_step){ .speed_hz = tune_speeds[i] };
+    }
+
+    printf("%-10s %-8s %-8s %-10s\n", "SPEED_HZ", "MESSAGES", "ERRORS", "BIT_ERRORS");
+
+    unsigned int clean = 0;
+
+    for (unsigned int i = 0; i < nsteps; i++) {
+        tune_step(fd, &steps[i], id_ref, iters);
+        printf("%-10u %-8lu %-8lu %-10lu\n", steps[i].speed_hz, steps[i].iters,
+               steps[i].bad, steps[i].bit_errors);
+        if (steps[i].bad)
+            break;
+        clean = i + 1;
+    }
+
+    speed_hz = start_hz;
+    if (zl_write_reg(fd, TUNE_SCRATCH_REG, scratch, sizeof(scratch)) < 0)
+        errx(EXIT_FAILURE, "restore scratch registers failed");
+    if (!clean)
+        errx(EXIT_FAILURE, "errors at the starting speed %u Hz, lower -s", start_hz);
+
+    /* highest clean step within the margin below the highest clean speed */
+    uint64_t limit = (uint64_t)steps[clean - 1].speed_hz * (100 - margin) / 100;
+    uint32_t best = start_hz;
+
+    for (unsigned int i = 0; i < clean; i++) {
+        if (steps[i].speed_hz <= limit)
+            best = steps[i].speed_hz;
+    }
+
+    printf("highest clean speed %u Hz, selected %u Hz (%u%% margin)\n",
+           steps[clean - 1].speed_hz, best, margin);
+
+    if (save) {
+        char val[16];
+        int rc;
+
+        snprintf(val, sizeof(val), "%u", best);
+        rc = zl_state_set(devnode, "speed_hz", val);
+        if (rc < 0)
+            errx(EXIT_FAILURE, "save state %s: %s", state_path, strerror(-rc));
+        printf("saved to %s\n", state_path);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static volatile sig_atomic_t stop;
+
+static void
+on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static void
+stress_usage(void)
+{
+    fprintf(stderr,
+        "Usage: stress [-n cycles] [-t seconds] [-e max_bit_errors]\n"
+        "  -n  pattern write/readback cycles (default 1000000)\n"
+        "  -t  stop after this many seconds (default: no limit)\n"
+        "  -e  stop once this many bit errors or failed transfers were seen\n"
+        "      (default 100, 0 = never)\n"
+        "Runs at the -s speed and -m mode; exits with failure on any error\n"
+    );
+}
+
+int
+cmd_stress(int fd, int argc, char **argv)
+{
+    static struct zl_plan plan;
+    unsigned long cycles = 1000000;
+    uint64_t max_bits = 100, limit_ns = 0;
+    int opt;
+
+    optind = 0;
+    while ((opt = getopt(argc, argv, "n:t:e:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            cycles = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            limit_ns = (uint64_t)(strtod(optarg, NULL) * 1e9);
+            break;
+        case 'e':
+            max_bits = strtoull(optarg, NULL, 0);
+            break;
+        case 'h':
+        default:
+            stress_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || cycles == 0) {
+        stress_usage();
+        return EXIT_FAILURE;
+    }
+
+    uint8_t id_ref[TUNE_ID_LEN], scratch[TUNE_SCRATCH_LEN];
+
+    if (zl_read_reg(fd, TUNE_ID_REG, id_ref, sizeof(id_ref)) < 0 ||
+        zl_read_reg(fd, TUNE_SCRATCH_REG, scratch, sizeof(scratch)) < 0)
+        errx(EXIT_FAILURE, "read reference registers failed at %u Hz", speed_hz);
+
+    int id_rx, wr_tx[STRESS_PAIRS], rd_rx[STRESS_PAIRS];
+
+    zl_plan_init(&plan);
+    id_rx = zl_plan_read(&plan, TUNE_ID_REG, TUNE_ID_LEN);
+    for (unsigned int k = 0; k < STRESS_PAIRS; k++) {
+        wr_tx[k] = zl_plan_write(&plan, TUNE_SCRATCH_REG, NULL, TUNE_SCRATCH_LEN);
+        rd_rx[k] = zl_plan_read(&plan, TUNE_SCRATCH_REG, TUNE_SCRATCH_LEN);
+        if (wr_tx[k] < 0 || rd_rx[k] < 0)
+            errx(EXIT_FAILURE, "stress message does not fit one SPI message");
+    }
+    if (id_rx < 0)
+        errx(EXIT_FAILURE, "cannot plan the stress message");
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    static struct zl_lat lat;
+    uint64_t bit_pos[8] = {0}, nbits = 0, checked = 0;
+    unsigned long nmsg = 0, done = 0, bad = 0, failed = 0;
+    uint32_t seed = 0x2545F491;
+
+    zl_lat_init(&lat);
+    uint64_t start = zl_now_ns(CLOCK_MONOTONIC), now = start;
+
+    /* failed transfers count against -e too, or a dead link would run on */
+    while (!stop && done < cycles &&
+           (!max_bits || (nbits < max_bits && failed < max_bits)) &&
+           (!limit_ns || now - start < limit_ns)) {
+        for (unsigned int k = 0; k < STRESS_PAIRS; k++) {
+            uint8_t *p = plan.tx + wr_tx[k];
+
+            for (size_t i = 0; i < TUNE_SCRATCH_LEN; i += 4) {
+                uint32_t r = xorshift32(&seed);
+
+                memcpy(p + i, &r, i + 4 <= TUNE_SCRATCH_LEN ? 4 : TUNE_SCRATCH_LEN - i);
+            }
+        }
+
+        uint64_t t0 = zl_now_ns(CLOCK_MONOTONIC);
+        int rc = zl_plan_submit(fd, &plan);
+
+        now = zl_now_ns(CLOCK_MONOTONIC);
+        zl_lat_add(&lat, now - t0);
+        nmsg++;
+        if (rc < 0) {
+            failed++;
+            continue;
+        }
+        done += STRESS_PAIRS;
+
+        unsigned int n = bit_errors_pos(plan.rx + id_rx, id_ref, TUNE_ID_LEN, bit_pos);
+
+        for (unsigned int k = 0; k < STRESS_PAIRS; k++)
+            n += bit_errors_pos(plan.rx + rd_rx[k], plan.tx + wr_tx[k], TUNE_SCRATCH_LEN,
+                                bit_pos);
+        checked += TUNE_ID_LEN + STRESS_PAIRS * TUNE_SCRATCH_LEN;
+        nbits += n;
+        bad += n != 0;
+        if (n && debug > 0)
+            fprintf(stderr, "stress: message %lu: %u bit errors\n", nmsg, n);
+    }
+
+    double secs = (double)(now - start) / 1e9;
+
+    if (zl_write_reg(fd, TUNE_SCRATCH_REG, scratch, sizeof(scratch)) < 0)
+        warnx("restore scratch registers failed");
+
+    printf("stress: %lu cycles in %lu messages, %.3f s at %u Hz, SPI mode %u\n",
+           done, nmsg, secs, speed_hz, mode & 3);
+    printf("  throughput %.0f bytes/s on the bus (%zu bytes per message), %.0f bytes/s checked\n",
+           secs > 0 ? (double)((nmsg - failed) * plan.len) / secs : 0, plan.len,
+           secs > 0 ? (double)checked / secs : 0);
+    printf("  %lu failed transfers, %lu messages with errors, %llu bit errors, BER %.3g\n",
+           failed, bad, (unsigned long long)nbits,
+           checked ? (double)nbits / (double)(checked * 8) : 0);
+    printf("  bit errors by position (7..0):");
+    for (int b = 7; b >= 0; b--)
+        printf(" %llu", (unsigned long long)bit_pos[b]);
+    printf("\n  bit error rate by position (7..0):");
+    for (int b = 7; b >= 0; b--)
+        printf(" %.2g", checked ? (double)bit_pos[b] / (double)checked : 0);
+    printf("\n");
+    fflush(stdout);
+    zl_lat_report(&lat, "stress message");
+
+    return failed || nbits ? EXIT_FAILURE : EXIT_SUCCESS;
+}